@@ -1,10 +1,22 @@
 #pragma once
 #include <functional>
 #include <string>
+#include <string_view>
 #include <iostream>
 #include <tuple>
 #include <map>
+#include <algorithm>
+#include <cstdint>
 #include <cstring>
+#include <iterator>
+#include <new>
+#include <optional>
+#include <type_traits>
+#include <typeinfo>
+#include <utility>
+#include <vector>
+
+#include "LuaLog.h"
 
 extern "C"
 {
@@ -26,7 +38,7 @@ void LuaPrintGlobals(lua_State *L)
     }
 }
 
-void LuaPrintStack(lua_State *L, int start = 0, int end = 0)
+void LuaPrintStack(lua_State *L, int start = 0, int end = 0, std::ostream &out = std::cout)
 {
     int level;
     int top = lua_gettop(L);
@@ -34,39 +46,55 @@ void LuaPrintStack(lua_State *L, int start = 0, int end = 0)
     {
         end = -top;
     }
-    std::cout << "Lua Stack (" << top << ") Entries" << std::endl;
-    std::cout << "Lua Stack Start: " << start << " End: " << end << std::endl;
+    out << "Lua Stack (" << top << ") Entries" << std::endl;
+    out << "Lua Stack Start: " << start << " End: " << end << std::endl;
     // we are counting -1, -2, -3, -4, -5, ...
     for (level = start; level >= end; level--)
     {
-        std::cout << "  [" << level << "]";
+        out << "  [" << level << "]";
         int t = lua_type(L, level);
         switch(t)
          {
             case LUA_TSTRING:
-                std::cout << " type: string     value: " << lua_tostring(L, level) << std::endl;
+                out << " type: string     value: " << lua_tostring(L, level) << std::endl;
                 break;
             case LUA_TBOOLEAN:
-                std::cout << " type: boolean    value: " << lua_tostring(L, level) << std::endl;
+                out << " type: boolean    value: " << lua_tostring(L, level) << std::endl;
                 break;
             case LUA_TNUMBER:
-                std::cout << " type: number     value: " << lua_tostring(L, level) << std::endl;
+                out << " type: number     value: " << lua_tostring(L, level) << std::endl;
                 break;
             case LUA_TTABLE:
-                std::cout << " type: table" << std::endl;
+                out << " type: table" << std::endl;
                 break;
             case LUA_TFUNCTION:
-                std::cout << " type: function" << std::endl;
+                out << " type: function" << std::endl;
                 break;
             case LUA_TUSERDATA:
-                std::cout << " type: userdata" << std::endl;
+                out << " type: userdata" << std::endl;
                 break;
             default:
-                std::cout << " type: unknown" << std::endl;
+                out << " type: unknown" << std::endl;
         }
     }
 }
 
+// LUA_LOG_STACK
+// dumps the stack to the log at trace level, compiled out above it
+#define LUA_LOG_STACK(L)                                           \
+  do                                                               \
+  {                                                                \
+    if constexpr (LUA_LOG_TRACE >= LUABINDER_LOG_LEVEL)            \
+    {                                                              \
+      if (LuaLog::enabled(LUA_LOG_TRACE))                          \
+      {                                                            \
+        std::ostringstream luaStackStream_;                        \
+        LuaPrintStack(L, 0, 0, luaStackStream_);                   \
+        LuaLog::write(LUA_LOG_TRACE, luaStackStream_.str());       \
+      }                                                            \
+    }                                                              \
+  } while (0)
+
 // ─── LuaPush ──────────────────────────────────────────────────────────────────
 
 // lua_push
@@ -75,7 +103,7 @@ void LuaPrintStack(lua_State *L, int start = 0, int end = 0)
 template <typename T>
 bool lua_pushdefault(lua_State *L, T &value)
 {
-    std::cout << "lua_push: not implemented for type: " << typeid(T).name() << std::endl;
+    LUA_LOG(LUA_LOG_WARN, "lua_push: not implemented for type: " << typeid(T).name());
     return false;
 }
 
@@ -85,7 +113,7 @@ bool lua_push(lua_State *L, T &&value)
     // if value is a pointer, push it as light userdata
     if (std::is_pointer<T &&>::value)
     {
-        std::cout << "lua_push: got type: " << typeid(T).name() << ", pushing function as userdata" << std::endl;
+        LUA_LOG(LUA_LOG_TRACE, "lua_push: got type: " << typeid(T).name() << ", pushing function as userdata");
         lua_pushlightuserdata(L, (void *)&&value);
         return true;
     }
@@ -97,7 +125,7 @@ bool lua_push(lua_State *L, T &value)
 {
     if (std::is_pointer<T &>::value)
     {
-        std::cout << "lua_push: got type: " << typeid(T).name() << ", pushing function as userdata" << std::endl;
+        LUA_LOG(LUA_LOG_TRACE, "lua_push: got type: " << typeid(T).name() << ", pushing function as userdata");
         lua_pushlightuserdata(L, (void *)&value);
         return true;
     }
@@ -109,7 +137,7 @@ bool lua_push(lua_State *L, T *value)
 {
     if (std::is_pointer<T *>::value)
     {
-        std::cout << "lua_push: got type: " << typeid(T).name() << ", pushing function as userdata" << std::endl;
+        LUA_LOG(LUA_LOG_TRACE, "lua_push: got type: " << typeid(T).name() << ", pushing function as userdata");
         lua_pushlightuserdata(L, (void *)value);
         return true;
     }
@@ -119,21 +147,24 @@ bool lua_push(lua_State *L, T *value)
 // ─── LuaCall ──────────────────────────────────────────────────────────────────
 // Used to call a function in a lua script
 
+template <typename T>
+struct LuaStack;
+
 template <typename T>
 T LuaCall(lua_State *L, const std::string &name, const std::vector<T> &args)
 {
     lua_getglobal(L, name.c_str());
     for (const auto &arg : args)
-        lua_push<T>(L, arg);
-    int e = lua_pcall(L, args.size(), 1, 0);
+        LuaStack<T>::push(L, arg);
+    int e = lua_pcall(L, static_cast<int>(args.size()), 1, 0);
     if (e)
     {
-        std::cout << "Error: " << lua_tostring(L, -1) << std::endl;
+        LUA_LOG(LUA_LOG_ERROR, "LuaCall: " << name << ": " << lua_tostring(L, -1));
         lua_pop(L, 1);
         return T();
     }
-    T ret;
-    lua_pop(L, ret);
+    T ret = LuaStack<T>::get(L, -1);
+    lua_pop(L, 1);
     return ret;
 }
 
@@ -583,6 +614,390 @@ struct LuaStack <std::string const&>
     }
 };
 
+//------------------------------------------------------------------------------
+/**
+  LuaStack specialization for `std::string_view`.
+  The view points into the lua string itself, nothing is copied. It stays
+  valid as long as the string is reachable from lua, for a bound function
+  argument that is the whole call.
+  */
+template <>
+struct LuaStack <std::string_view>
+{
+    static inline void push (lua_State* L, std::string_view str)
+    {
+        lua_pushlstring (L, str.data(), str.size());
+    }
+
+    static inline std::string_view get (lua_State* L, int index)
+    {
+        size_t len;
+        const char *str = luaL_checklstring(L, index, &len);
+        return std::string_view (str, len);
+    }
+};
+
+// ─── LuaRef ──────────────────────────────────────────────────────────────────
+
+/**
+  Remember the main thread of L's state, LuaScript does this when it creates
+  or adopts a state. Does nothing when L is a coroutine.
+  */
+inline void LuaSetMainThread (lua_State* L)
+{
+    if (!lua_pushthread (L))
+    {
+        lua_pop (L, 1);
+        return;
+    }
+    lua_setfield (L, LUA_REGISTRYINDEX, "LuaBinder.MainThread");
+}
+
+/**
+  Get the main thread of the state L belongs to.
+  A coroutine is collected with its last reference, anything kept past the
+  current call must hold the main thread instead. Falls back to L when L is
+  a coroutine of a state nobody called LuaSetMainThread on.
+  */
+inline lua_State* LuaMainThread (lua_State* L)
+{
+    if (lua_pushthread (L))
+    {
+        lua_pop (L, 1);
+        return L;
+    }
+    lua_pop (L, 1);
+    lua_getfield (L, LUA_REGISTRYINDEX, "LuaBinder.MainThread");
+    lua_State* main = lua_tothread (L, -1);
+    lua_pop (L, 1);
+    return main ? main : L;
+}
+
+/**
+  A registry reference to a lua value.
+  Pins the value with luaL_ref so it can be pushed back in O(1) without a
+  global lookup, and releases it with luaL_unref when destroyed. The
+  lua_State must outlive every LuaRef taken from it.
+  */
+class LuaRef
+{
+public:
+    LuaRef () = default;
+
+    /** Reference the value at `index`, the stack is left unchanged */
+    LuaRef (lua_State* L, int index) : L (LuaMainThread (L))
+    {
+        lua_pushvalue (L, index);
+        ref = luaL_ref (L, LUA_REGISTRYINDEX);
+    }
+
+    /** Pop the value on top of the stack into a new reference */
+    static LuaRef fromTop (lua_State* L)
+    {
+        LuaRef r;
+        r.L = LuaMainThread (L);
+        r.ref = luaL_ref (L, LUA_REGISTRYINDEX);
+        return r;
+    }
+
+    LuaRef (LuaRef const& other) : L (other.L)
+    {
+        if (L)
+        {
+            other.push ();
+            ref = luaL_ref (L, LUA_REGISTRYINDEX);
+        }
+    }
+
+    LuaRef (LuaRef&& other) noexcept : L (other.L), ref (other.ref)
+    {
+        other.L = nullptr;
+        other.ref = LUA_NOREF;
+    }
+
+    LuaRef& operator= (LuaRef const& other)
+    {
+        if (this != &other)
+        {
+            LuaRef copy (other);
+            *this = std::move (copy);
+        }
+        return *this;
+    }
+
+    LuaRef& operator= (LuaRef&& other) noexcept
+    {
+        if (this != &other)
+        {
+            reset ();
+            L = other.L;
+            ref = other.ref;
+            other.L = nullptr;
+            other.ref = LUA_NOREF;
+        }
+        return *this;
+    }
+
+    ~LuaRef ()
+    {
+        reset ();
+    }
+
+    /** Release the reference */
+    void reset ()
+    {
+        if (L)
+            luaL_unref (L, LUA_REGISTRYINDEX, ref);
+        L = nullptr;
+        ref = LUA_NOREF;
+    }
+
+    /** Push the referenced value onto the main thread of the owning state */
+    void push () const
+    {
+        lua_rawgeti (L, LUA_REGISTRYINDEX, ref);
+    }
+
+    /** Push the referenced value onto `L`, which must share the registry */
+    void push (lua_State* L) const
+    {
+        lua_rawgeti (L, LUA_REGISTRYINDEX, ref);
+    }
+
+    /** Get the referenced value as T */
+    template <typename T>
+    T get () const
+    {
+        push ();
+        T value = LuaStack<T>::get (L, -1);
+        lua_pop (L, 1);
+        return value;
+    }
+
+    /** Get the lua type of the referenced value, LUA_TNIL for an empty ref */
+    int type () const
+    {
+        if (!L)
+            return LUA_TNIL;
+        push ();
+        int t = lua_type (L, -1);
+        lua_pop (L, 1);
+        return t;
+    }
+
+    bool isNil () const { return !L || ref == LUA_REFNIL || type () == LUA_TNIL; }
+    lua_State* state () const { return L; }
+    int id () const { return ref; }
+
+private:
+    lua_State* L = nullptr;
+    int ref = LUA_NOREF;
+};
+
+//------------------------------------------------------------------------------
+/**
+  LuaStack specialization for `LuaRef`.
+  */
+template <>
+struct LuaStack <LuaRef>
+{
+    static inline void push (lua_State* L, LuaRef const& ref)
+    {
+        ref.push (L);
+    }
+
+    static inline LuaRef get (lua_State* L, int index)
+    {
+        return LuaRef (L, index);
+    }
+};
+
+// ─── LuaTableRange ───────────────────────────────────────────────────────────
+
+/**
+  A key/value pair reached while walking a table.
+  The key is at -2 and the value at -1 of the stack, both stay there until
+  the iterator advances.
+  */
+struct LuaTableEntry
+{
+    lua_State* L;
+
+    int keyType () const { return lua_type (L, -2); }
+    int valueType () const { return lua_type (L, -1); }
+
+    /** Get the key as T
+     * non string keys are converted on a copy so lua_next still sees the
+     * original key, a std::string_view is only valid for string keys
+     */
+    template <typename T>
+    T key () const
+    {
+        if (lua_type (L, -2) == LUA_TSTRING)
+            return LuaStack<T>::get (L, -2);
+        lua_pushvalue (L, -2);
+        T value = LuaStack<T>::get (L, -1);
+        lua_pop (L, 1);
+        return value;
+    }
+
+    /** Get the value as T */
+    template <typename T>
+    T value () const
+    {
+        return LuaStack<T>::get (L, -1);
+    }
+};
+
+/**
+  Lazy walk over a table with lua_next.
+  Nothing is allocated per step, the walk state lives on the lua stack.
+  The table must stay at `index` for the whole walk, the loop body must
+  leave the stack as it found it and must not add keys to the table.
+  Leaving the loop early restores the stack.
+
+      for (LuaTableEntry entry : LuaTableRange (L, -1))
+          entry.key<std::string> ();
+  */
+class LuaTableRange
+{
+public:
+    LuaTableRange (lua_State* L, int index)
+        : L (L), table (index < 0 && index > LUA_REGISTRYINDEX ? lua_gettop (L) + index + 1 : index)
+    {
+    }
+
+    class iterator
+    {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = LuaTableEntry;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = LuaTableEntry;
+
+        iterator () = default;
+
+        iterator (lua_State* L, int table) : L (L), table (table), top (lua_gettop (L))
+        {
+            lua_pushnil (L);
+            active = lua_next (L, table) != 0;
+        }
+
+        iterator (iterator const&) = delete;
+        iterator& operator= (iterator const&) = delete;
+
+        iterator (iterator&& other) noexcept
+            : L (other.L), table (other.table), top (other.top), active (other.active)
+        {
+            other.active = false;
+        }
+
+        ~iterator ()
+        {
+            if (active)
+                lua_settop (L, top);
+        }
+
+        iterator& operator++ ()
+        {
+            lua_pop (L, 1);
+            active = lua_next (L, table) != 0;
+            return *this;
+        }
+
+        LuaTableEntry operator* () const { return LuaTableEntry { L }; }
+
+        bool operator== (iterator const& other) const { return active == other.active; }
+        bool operator!= (iterator const& other) const { return active != other.active; }
+
+    private:
+        lua_State* L = nullptr;
+        int table = 0;
+        int top = 0;
+        bool active = false;
+    };
+
+    iterator begin () const { return iterator (L, table); }
+    iterator end () const { return iterator (); }
+
+    // typed projections, e.g. for (std::string k : range.keys<std::string> ())
+    template <typename K>
+    auto keys () const;
+    template <typename V>
+    auto values () const;
+    template <typename K, typename V>
+    auto pairs () const;
+
+private:
+    lua_State* L;
+    int table;
+};
+
+/**
+  A LuaTableRange whose iterator yields Proj::get (entry) instead of the entry.
+  */
+template <typename Proj>
+class LuaTableProjection
+{
+public:
+    explicit LuaTableProjection (LuaTableRange range) : range (range) {}
+
+    class iterator
+    {
+    public:
+        explicit iterator (LuaTableRange::iterator&& it) : it (std::move (it)) {}
+        iterator& operator++ () { ++it; return *this; }
+        auto operator* () const { return Proj::get (*it); }
+        bool operator!= (iterator const& other) const { return it != other.it; }
+        bool operator== (iterator const& other) const { return it == other.it; }
+
+    private:
+        LuaTableRange::iterator it;
+    };
+
+    iterator begin () const { return iterator (range.begin ()); }
+    iterator end () const { return iterator (range.end ()); }
+
+private:
+    LuaTableRange range;
+};
+
+template <typename K>
+struct LuaTableKey
+{
+    static K get (LuaTableEntry const& e) { return e.key<K> (); }
+};
+
+template <typename V>
+struct LuaTableValue
+{
+    static V get (LuaTableEntry const& e) { return e.value<V> (); }
+};
+
+template <typename K, typename V>
+struct LuaTablePair
+{
+    static std::pair<K, V> get (LuaTableEntry const& e) { return std::pair<K, V> (e.key<K> (), e.value<V> ()); }
+};
+
+template <typename K>
+auto LuaTableRange::keys () const
+{
+    return LuaTableProjection<LuaTableKey<K>> (*this);
+}
+
+template <typename V>
+auto LuaTableRange::values () const
+{
+    return LuaTableProjection<LuaTableValue<V>> (*this);
+}
+
+template <typename K, typename V>
+auto LuaTableRange::pairs () const
+{
+    return LuaTableProjection<LuaTablePair<K, V>> (*this);
+}
 
 // ─── LuaGet ────────────────────────────────────────────────────────────────────
 
@@ -607,16 +1022,323 @@ bool lua_set(lua_State* L, T value, int level = 0)
 
 // ─── LuaTuple ──────────────────────────────────────────────────────────────────
 
+// LuaTuple
+// read consecutive stack slots starting at `level` into a tuple
+template <typename... Args, std::size_t... I>
+std::tuple<Args...> LuaTupleGet(lua_State *L, int level, std::index_sequence<I...>)
+{
+    return std::tuple<Args...>(lua_get<Args>(L, level + static_cast<int>(I))...);
+}
+
 template <typename... Args>
 std::tuple<Args...> LuaTuple(lua_State *L, int level)
 {
-    return std::make_tuple(lua_get<Args>(L, level)...);
+    return LuaTupleGet<Args...>(L, level, std::index_sequence_for<Args...>{});
+}
+
+// LuaTuple
+// write a tuple into consecutive stack slots starting at `level`, or push
+// every element when level is 0
+template <typename... Args, std::size_t... I>
+bool LuaTupleSet(lua_State *L, int level, const std::tuple<Args...> &value, std::index_sequence<I...>)
+{
+    (lua_set<Args>(L, std::get<I>(value), level ? level + static_cast<int>(I) : 0), ...);
+    return true;
 }
 
 template <typename... Args>
 bool LuaTuple(lua_State *L, int level, std::tuple<Args...> &&value)
 {
-    int i = level;
-    (void)std::initializer_list<int>{(lua_set(L, i++, std::get<Args>(value)), 0)...};
-    return true;
+    return LuaTupleSet(L, level, value, std::index_sequence_for<Args...>{});
+}
+
+// ─── LuaReturn ─────────────────────────────────────────────────────────────────
+
+// LuaReturn
+// how a bound function's result crosses the stack: std::tuple and std::pair
+// become one lua value per element, anything else a single value
+template <typename T>
+struct LuaReturn
+{
+    static constexpr int count = 1;
+
+    static int push(lua_State *L, const T &value)
+    {
+        LuaStack<T>::push(L, value);
+        return 1;
+    }
+
+    static T get(lua_State *L, int first)
+    {
+        return LuaStack<T>::get(L, first);
+    }
+};
+
+template <typename... Ts>
+struct LuaReturn<std::tuple<Ts...>>
+{
+    static constexpr int count = static_cast<int>(sizeof...(Ts));
+
+    static int push(lua_State *L, const std::tuple<Ts...> &value)
+    {
+        std::apply([L](const Ts &...v) { (LuaStack<std::remove_cv_t<std::remove_reference_t<Ts>>>::push(L, v), ...); }, value);
+        return count;
+    }
+
+    static std::tuple<Ts...> get(lua_State *L, int first)
+    {
+        return Get(L, first, std::index_sequence_for<Ts...>{});
+    }
+
+private:
+    template <std::size_t... I>
+    static std::tuple<Ts...> Get(lua_State *L, int first, std::index_sequence<I...>)
+    {
+        return std::tuple<Ts...>(LuaStack<std::remove_cv_t<std::remove_reference_t<Ts>>>::get(L, first + static_cast<int>(I))...);
+    }
+};
+
+template <typename A, typename B>
+struct LuaReturn<std::pair<A, B>>
+{
+    static constexpr int count = 2;
+
+    static int push(lua_State *L, const std::pair<A, B> &value)
+    {
+        LuaStack<std::remove_cv_t<std::remove_reference_t<A>>>::push(L, value.first);
+        LuaStack<std::remove_cv_t<std::remove_reference_t<B>>>::push(L, value.second);
+        return 2;
+    }
+
+    static std::pair<A, B> get(lua_State *L, int first)
+    {
+        return std::pair<A, B>(LuaStack<std::remove_cv_t<std::remove_reference_t<A>>>::get(L, first),
+                               LuaStack<std::remove_cv_t<std::remove_reference_t<B>>>::get(L, first + 1));
+    }
+};
+
+// LuaResultIs
+// checks a result slot so LuaCall can convert it outside a protected call,
+// known for the types whose LuaStack::get can't raise once the check passed
+template <typename T, typename = void>
+struct LuaResultIs
+{
+    static constexpr bool known = false;
+};
+
+template <typename T>
+struct LuaResultIs<T, std::enable_if_t<std::is_arithmetic<T>::value && !std::is_same<T, bool>::value && !std::is_same<T, char>::value>>
+{
+    static constexpr bool known = true;
+    static bool check(lua_State *L, int index) { return lua_type(L, index) == LUA_TNUMBER; }
+};
+
+template <>
+struct LuaResultIs<bool>
+{
+    static constexpr bool known = true;
+    static bool check(lua_State *, int) { return true; }
+};
+
+template <>
+struct LuaResultIs<std::string>
+{
+    static constexpr bool known = true;
+    static bool check(lua_State *L, int index) { return lua_type(L, index) == LUA_TSTRING || lua_type(L, index) == LUA_TNUMBER; }
+};
+
+template <>
+struct LuaResultIs<LuaRef>
+{
+    static constexpr bool known = true;
+    static bool check(lua_State *, int) { return true; }
+};
+
+template <typename... Ts>
+struct LuaResultIs<std::tuple<Ts...>>
+{
+    static constexpr bool known = (LuaResultIs<std::remove_cv_t<std::remove_reference_t<Ts>>>::known && ...);
+    static bool check(lua_State *L, int first) { return Check(L, first, std::index_sequence_for<Ts...>{}); }
+
+private:
+    template <std::size_t... I>
+    static bool Check(lua_State *L, int first, std::index_sequence<I...>)
+    {
+        return (LuaResultIs<std::remove_cv_t<std::remove_reference_t<Ts>>>::check(L, first + static_cast<int>(I)) && ...);
+    }
+};
+
+template <typename A, typename B>
+struct LuaResultIs<std::pair<A, B>>
+{
+    using First = LuaResultIs<std::remove_cv_t<std::remove_reference_t<A>>>;
+    using Second = LuaResultIs<std::remove_cv_t<std::remove_reference_t<B>>>;
+    static constexpr bool known = First::known && Second::known;
+    static bool check(lua_State *L, int first) { return First::check(L, first) && Second::check(L, first + 1); }
+};
+
+// LuaReturnTo
+// converts the LuaReturn<T>::count values at first into out without raising,
+// 0 on success. On a mismatch the message is pushed and a non-zero status
+// returned, like lua_pcall. Types LuaResultIs can't check are converted in a
+// protected call of their own.
+template <typename T>
+struct LuaReturnConvert
+{
+    static int Run(lua_State *L)
+    {
+        *static_cast<T *>(lua_touserdata(L, 1)) = LuaReturn<T>::get(L, 2);
+        return 0;
+    }
+
+    // the Run function, created once per state and kept in the registry
+    static void Push(lua_State *L)
+    {
+        static const char key = 0;
+        lua_pushlightuserdata(L, const_cast<char *>(&key));
+        lua_rawget(L, LUA_REGISTRYINDEX);
+        if (lua_isnil(L, -1))
+        {
+            lua_pop(L, 1);
+            lua_pushcfunction(L, &Run);
+            lua_pushlightuserdata(L, const_cast<char *>(&key));
+            lua_pushvalue(L, -2);
+            lua_rawset(L, LUA_REGISTRYINDEX);
+        }
+    }
+};
+
+template <typename T>
+int LuaReturnTo(lua_State *L, int first, T &out)
+{
+    if constexpr (LuaResultIs<T>::known)
+    {
+        if (LuaResultIs<T>::check(L, first))
+        {
+            out = LuaReturn<T>::get(L, first);
+            return 0;
+        }
+        if (LuaReturn<T>::count == 1)
+            lua_pushfstring(L, "unexpected value of type %s", luaL_typename(L, first));
+        else
+            lua_pushfstring(L, "unexpected values, the first of type %s", luaL_typename(L, first));
+        return LUA_ERRRUN;
+    }
+    else
+    {
+        constexpr int count = LuaReturn<T>::count;
+        if (!lua_checkstack(L, count + 2))
+        {
+            lua_pushstring(L, "stack overflow");
+            return LUA_ERRRUN;
+        }
+        LuaReturnConvert<T>::Push(L);
+        lua_pushlightuserdata(L, &out);
+        for (int i = 0; i < count; i++)
+            lua_pushvalue(L, first + i);
+        return lua_pcall(L, count + 1, 0, 0);
+    }
+}
+
+// LuaCall
+// call a global lua function with typed arguments, e.g.
+// auto [x, y] = LuaCall<std::tuple<double, double>>(L, "center", rect, 0.5);
+// the call asks lua for exactly LuaReturn<Ret>::count results, extra ones are
+// dropped and missing ones are nil. A lua error or a result that is not a Ret
+// is logged and Ret() returned. Results of the LuaResultIs types are checked
+// after a plain lua_pcall, any other Ret is converted inside a protected
+// call of its own.
+template <typename Ret, typename... Args>
+struct LuaCallFrame
+{
+    using Value = std::conditional_t<std::is_void<Ret>::value, int, Ret>;
+    static constexpr int results = std::is_void<Ret>::value ? 0 : LuaReturn<Value>::count;
+
+    const std::string &name;
+    std::tuple<const Args &...> args;
+    Value ret{};
+
+    // runs inside lua_pcall with the frame as light userdata at 1
+    static int Run(lua_State *L)
+    {
+        LuaCallFrame *frame = static_cast<LuaCallFrame *>(lua_touserdata(L, 1));
+        lua_getglobal(L, frame->name.c_str());
+        std::apply([L](const Args &...a) { (LuaStack<std::remove_cv_t<std::remove_reference_t<Args>>>::push(L, a), ...); }, frame->args);
+        lua_call(L, static_cast<int>(sizeof...(Args)), results);
+        if constexpr (!std::is_void<Ret>::value)
+            frame->ret = LuaReturn<Value>::get(L, 2);
+        return 0;
+    }
+
+    // the Run closure, created once per state and kept in the registry
+    static void PushRun(lua_State *L)
+    {
+        static const char key = 0;
+        lua_pushlightuserdata(L, const_cast<char *>(&key));
+        lua_rawget(L, LUA_REGISTRYINDEX);
+        if (lua_isnil(L, -1))
+        {
+            lua_pop(L, 1);
+            lua_pushcfunction(L, &Run);
+            lua_pushlightuserdata(L, const_cast<char *>(&key));
+            lua_pushvalue(L, -2);
+            lua_rawset(L, LUA_REGISTRYINDEX);
+        }
+    }
+};
+
+// converts the results inside the protected call, for the Ret types
+// LuaResultIs can't check
+template <typename Ret, typename... Args>
+Ret LuaCallProtected(lua_State *L, const std::string &name, int top, const Args &...args)
+{
+    using Frame = LuaCallFrame<Ret, Args...>;
+    Frame frame{name, std::tuple<const Args &...>(args...)};
+    Frame::PushRun(L);
+    lua_pushlightuserdata(L, &frame);
+    if (lua_pcall(L, 1, 0, 0))
+    {
+        LUA_LOG(LUA_LOG_ERROR, "LuaCall: " << name << ": " << lua_tostring(L, -1));
+        lua_settop(L, top);
+        return static_cast<Ret>(typename Frame::Value{});
+    }
+    return static_cast<Ret>(std::move(frame.ret));
+}
+
+template <typename Ret, typename... Args>
+Ret LuaCall(lua_State *L, const std::string &name, const Args &...args)
+{
+    using Frame = LuaCallFrame<Ret, Args...>;
+    using Value = typename Frame::Value;
+    int top = lua_gettop(L);
+    if (!lua_checkstack(L, static_cast<int>(sizeof...(Args)) + Frame::results + 3))
+    {
+        LUA_LOG(LUA_LOG_ERROR, "LuaCall: " << name << ": stack overflow");
+        return static_cast<Ret>(Value{});
+    }
+    if constexpr (std::is_void<Ret>::value || LuaResultIs<Value>::known)
+    {
+        lua_getglobal(L, name.c_str());
+        (LuaStack<std::remove_cv_t<std::remove_reference_t<Args>>>::push(L, args), ...);
+        if (lua_pcall(L, static_cast<int>(sizeof...(Args)), Frame::results, 0))
+        {
+            LUA_LOG(LUA_LOG_ERROR, "LuaCall: " << name << ": " << lua_tostring(L, -1));
+            lua_settop(L, top);
+            return static_cast<Ret>(Value{});
+        }
+        if constexpr (std::is_void<Ret>::value)
+            lua_settop(L, top);
+        else
+        {
+            Value ret{};
+            if (LuaResultIs<Value>::check(L, top + 1))
+                ret = LuaReturn<Value>::get(L, top + 1);
+            else
+                LUA_LOG(LUA_LOG_ERROR, "LuaCall: " << name << ": unexpected result type " << luaL_typename(L, top + 1));
+            lua_settop(L, top);
+            return ret;
+        }
+    }
+    else
+        return LuaCallProtected<Ret>(L, name, top, args...);
 }
@@ -0,0 +1,226 @@
+// Copyright (C) 2023 Theros < MisModding | SvalTek >
+//
+// This file is part of LuaBinder.
+//
+// LuaBinder is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LuaBinder is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LuaBinder.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+#include "Lua.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+// ─── LuaAllocator ────────────────────────────────────────────────────────────
+
+// LuaAllocStats
+// counters kept by every LuaAllocator
+struct LuaAllocStats
+{
+  size_t bytesInUse = 0;  // bytes currently handed out to lua
+  size_t peakBytes = 0;   // highest bytesInUse seen
+  size_t allocations = 0; // allocations and growing reallocations
+  size_t frees = 0;       // blocks returned by lua
+  size_t reserved = 0;    // bytes held from the system, arena chunks included
+};
+
+// class LuaAllocator
+// Allocator policy for a LuaScript. function() is handed to lua_newstate
+// with userdata() and called directly by lua, there is no virtual call per
+// allocation. The allocator is destroyed after the state is closed.
+class LuaAllocator
+{
+public:
+  virtual ~LuaAllocator() = default;
+  virtual lua_Alloc function() const = 0;
+  virtual void *userdata() { return this; }
+  const LuaAllocStats &stats() const { return counters; }
+
+protected:
+  void onAlloc(size_t osize, size_t nsize)
+  {
+    counters.bytesInUse += nsize - osize;
+    if (counters.bytesInUse > counters.peakBytes)
+      counters.peakBytes = counters.bytesInUse;
+    if (nsize > osize)
+      counters.allocations++;
+  }
+
+  void onFree(size_t osize)
+  {
+    counters.bytesInUse -= osize;
+    counters.frees++;
+  }
+
+  LuaAllocStats counters;
+};
+
+// class LuaMallocAllocator
+// The system allocator, with statistics
+class LuaMallocAllocator : public LuaAllocator
+{
+public:
+  lua_Alloc function() const override { return &Alloc; }
+
+  static void *Alloc(void *ud, void *ptr, size_t osize, size_t nsize)
+  {
+    LuaMallocAllocator *self = static_cast<LuaMallocAllocator *>(ud);
+    if (ptr == nullptr)
+      osize = 0;
+    if (nsize == 0)
+    {
+      if (ptr)
+        self->onFree(osize);
+      std::free(ptr);
+      return nullptr;
+    }
+    void *block = std::realloc(ptr, nsize);
+    if (block)
+    {
+      self->onAlloc(osize, nsize);
+      self->counters.reserved = self->counters.bytesInUse;
+    }
+    return block;
+  }
+};
+
+// class LuaPoolAllocator
+// Size-class pool for the many small blocks lua allocates (strings, tables,
+// closures, upvalues). Blocks up to MaxSmall bytes are carved from arena
+// chunks and recycled through one freelist per size class, larger blocks go
+// to malloc. The pool belongs to a single lua_State, which only ever runs on
+// one thread at a time, so the freelists need no locking or TLS lookup.
+// Chunks are released in bulk when the allocator is destroyed.
+class LuaPoolAllocator : public LuaAllocator
+{
+public:
+  static constexpr size_t Granularity = 16;
+  static constexpr size_t MaxSmall = 512;
+  static constexpr size_t Classes = MaxSmall / Granularity;
+
+  /** @param chunkSize bytes reserved from the system per arena chunk */
+  explicit LuaPoolAllocator(size_t chunkSize = 64 * 1024) : chunkSize(chunkSize < MaxSmall ? MaxSmall : chunkSize)
+  {
+    std::memset(freelists, 0, sizeof(freelists));
+  }
+
+  ~LuaPoolAllocator() override
+  {
+    for (void *chunk : chunks)
+      std::free(chunk);
+  }
+
+  LuaPoolAllocator(const LuaPoolAllocator &) = delete;
+  LuaPoolAllocator &operator=(const LuaPoolAllocator &) = delete;
+
+  lua_Alloc function() const override { return &Alloc; }
+
+  static void *Alloc(void *ud, void *ptr, size_t osize, size_t nsize)
+  {
+    LuaPoolAllocator *self = static_cast<LuaPoolAllocator *>(ud);
+    if (ptr == nullptr)
+      osize = 0;
+    if (nsize == 0)
+    {
+      if (ptr)
+      {
+        self->release(ptr, osize);
+        self->onFree(osize);
+      }
+      return nullptr;
+    }
+    if (ptr && ClassOf(osize) == ClassOf(nsize) && nsize <= MaxSmall)
+    { // same block still fits
+      self->onAlloc(osize, nsize);
+      return ptr;
+    }
+    if (ptr && osize > MaxSmall && nsize > MaxSmall)
+    {
+      void *block = std::realloc(ptr, nsize);
+      if (block)
+      {
+        self->counters.reserved += nsize - osize;
+        self->onAlloc(osize, nsize);
+      }
+      return block;
+    }
+    void *block = self->acquire(nsize);
+    if (!block)
+      return nullptr;
+    if (ptr)
+    {
+      std::memcpy(block, ptr, osize < nsize ? osize : nsize);
+      self->release(ptr, osize);
+    }
+    self->onAlloc(osize, nsize);
+    return block;
+  }
+
+private:
+  struct FreeBlock
+  {
+    FreeBlock *next;
+  };
+
+  static size_t ClassOf(size_t size) { return (size + Granularity - 1) / Granularity - 1; }
+
+  void *acquire(size_t size)
+  {
+    if (size > MaxSmall)
+    {
+      void *block = std::malloc(size);
+      if (block)
+        counters.reserved += size;
+      return block;
+    }
+    size_t c = ClassOf(size);
+    if (FreeBlock *block = freelists[c])
+    {
+      freelists[c] = block->next;
+      return block;
+    }
+    size_t blockSize = (c + 1) * Granularity;
+    if (static_cast<size_t>(end - cursor) < blockSize)
+    {
+      char *chunk = static_cast<char *>(std::malloc(chunkSize));
+      if (!chunk)
+        return nullptr;
+      chunks.push_back(chunk);
+      counters.reserved += chunkSize;
+      cursor = chunk;
+      end = chunk + chunkSize;
+    }
+    void *block = cursor;
+    cursor += blockSize;
+    return block;
+  }
+
+  void release(void *ptr, size_t size)
+  {
+    if (size > MaxSmall)
+    {
+      std::free(ptr);
+      counters.reserved -= size;
+      return;
+    }
+    size_t c = ClassOf(size);
+    FreeBlock *block = static_cast<FreeBlock *>(ptr);
+    block->next = freelists[c];
+    freelists[c] = block;
+  }
+
+  size_t chunkSize;
+  FreeBlock *freelists[Classes];
+  std::vector<void *> chunks;
+  char *cursor = nullptr;
+  char *end = nullptr;
+};
@@ -2,7 +2,6 @@
 
 bool enable_debug = false;
 
-lua_State *L = luaL_newstate();
 LuaScript *Script;
 
 int add(int a, int b)
@@ -10,7 +9,7 @@ int add(int a, int b)
     return a + b;
 };
 
-void log(std::string message)
+void log(std::string_view message)
 {
     std::cout << message << std::endl;
 }
@@ -19,13 +18,13 @@ int main(int argc, char *argv[])
 {
     system("cls");
 
-    Script = new LuaScript(L);
+    Script = new LuaScript(std::make_unique<LuaPoolAllocator>());
 
     // register Lua functions
     LuaFunction<int(int, int)> luaAdd(add);
     luaAdd.Register(Script->State(), "add");
 
-    LuaFunction<void(std::string)> luaLog(log);
+    LuaFunction<void(std::string_view)> luaLog(log);
     luaLog.Register(Script->State(), "Log");
 
     if (!Script->runString("testList = { 'Item1', 'Item2', 'Item3' }; testMap = { key1 = 'Value1', key2 = 'Value2', key3 = 'Value3' }; Log('hello world Result: ' .. add(10, 20))"))
@@ -74,6 +73,9 @@ int main(int argc, char *argv[])
     //     std::cout << "  " << item.first << " = " << item.second << std::endl;
     // }
 
+    if (const LuaAllocStats *stats = Script->AllocStats())
+        std::cout << "Lua memory: " << stats->bytesInUse << " bytes in use, " << stats->peakBytes << " peak, " << stats->allocations << " allocations" << std::endl;
+
     system("pause");
     return 0;
 }
@@ -0,0 +1,1096 @@
+// Copyright (C) 2023 Theros < MisModding | SvalTek >
+//
+// This file is part of LuaBinder.
+//
+// LuaBinder is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LuaBinder is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LuaBinder.  If not, see <http://www.gnu.org/licenses/>.
+
+// LuaBinder_bench
+// Measures the binding layer against hand written Lua C API baselines.
+// Every case prints one JSON object per line to stdout:
+//   {"name": ..., "baseline": ..., "ns_per_op": ..., "p50": ..., ...}
+// usage: LuaBinder_bench [filter] [samples]
+// configure with -DCMAKE_BUILD_TYPE=Release for meaningful numbers
+#include "Global.h"
+#include "LuaBuffer.h"
+#include "LuaClass.h"
+#include "LuaScheduler.h"
+#include "LuaSerializer.h"
+#include "LuaStatePool.h"
+#include "LuaStruct.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <vector>
+
+// ─── Allocation counting ─────────────────────────────────────────────────────
+
+static std::size_t cppAllocs = 0;
+static std::size_t luaAllocs = 0;
+
+// gcc sees free() on a pointer from operator new once these are inlined,
+// both sides are replaced here so the pair does match
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void *operator new(std::size_t size)
+{
+  ++cppAllocs;
+  if (void *p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+
+// CountingAlloc
+// lua_Alloc that counts every allocation and reallocation made by the state
+static void *CountingAlloc(void *, void *ptr, size_t, size_t nsize)
+{
+  if (nsize == 0)
+  {
+    std::free(ptr);
+    return nullptr;
+  }
+  ++luaAllocs;
+  return std::realloc(ptr, nsize);
+}
+
+// ─── Harness ─────────────────────────────────────────────────────────────────
+
+struct BenchResult
+{
+  double mean = 0;
+};
+
+static const char *benchFilter = nullptr;
+static int benchSamples = 50;
+static std::map<std::string, BenchResult> benchResults;
+
+// ProtectedCheck
+// runs a validation function inside lua_cpcall so a lua error in the
+// binding under test is reported instead of aborting the whole suite
+struct ProtectedCheck
+{
+  std::function<bool()> *check;
+  bool ok;
+};
+
+static int RunProtectedCheck(lua_State *L)
+{
+  ProtectedCheck *p = static_cast<ProtectedCheck *>(lua_touserdata(L, 1));
+  p->ok = (*p->check)();
+  return 0;
+}
+
+// Silence
+// keeps anything the code under test writes to the console out of the results
+struct Silence
+{
+  std::streambuf *out = std::cout.rdbuf(nullptr);
+  std::streambuf *err = std::cerr.rdbuf(nullptr);
+  ~Silence()
+  {
+    std::cout.rdbuf(out);
+    std::cerr.rdbuf(err);
+    std::cout.clear();
+    std::cerr.clear();
+  }
+};
+
+// JsonEscape
+// lua error messages may contain quotes or control characters
+static std::string JsonEscape(const std::string &text)
+{
+  std::string out;
+  for (char c : text)
+  {
+    if (c == '"' || c == '\\')
+      out += '\\';
+    if (static_cast<unsigned char>(c) < 0x20)
+      c = ' ';
+    out += c;
+  }
+  return out;
+}
+
+static double Percentile(const std::vector<double> &sorted, double p)
+{
+  size_t i = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+  return sorted[std::min(i, sorted.size() - 1)];
+}
+
+/** Run and report a single benchmark case
+ * @param name case name
+ * @param baseline name of the raw C API case to compare against, or nullptr
+ * @param L state the case runs in, used to protect the validation
+ * @param check returns false if the binding produced a wrong result
+ * @param op runs the operation n times
+ */
+static void Bench(const std::string &name, const char *baseline, lua_State *L,
+                  std::function<bool()> check, std::function<void(size_t)> op)
+{
+  using Clock = std::chrono::steady_clock;
+  if (benchFilter && name.find(benchFilter) == std::string::npos)
+    return;
+
+  int top = lua_gettop(L);
+  ProtectedCheck pc{&check, false};
+  int status;
+  {
+    Silence silence;
+    status = lua_cpcall(L, &RunProtectedCheck, &pc);
+  }
+  if (status != 0 || !pc.ok)
+  {
+    std::string error = status != 0 && lua_isstring(L, -1) ? lua_tostring(L, -1) : "wrong result";
+    lua_settop(L, top);
+    printf("{\"name\": \"%s\", \"error\": \"%s\"}\n", name.c_str(), JsonEscape(error).c_str());
+    fflush(stdout);
+    return;
+  }
+  lua_settop(L, top);
+
+  Silence silence;
+  // calibrate so that one sample takes roughly a millisecond
+  size_t n = 1;
+  for (;;)
+  {
+    auto start = Clock::now();
+    op(n);
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+    if (elapsed >= 1000000 || n >= (size_t(1) << 24))
+      break;
+    n *= 2;
+  }
+
+  std::vector<double> samples;
+  samples.reserve(benchSamples);
+  size_t cppBefore = cppAllocs;
+  size_t luaBefore = luaAllocs;
+  for (int s = 0; s < benchSamples; s++)
+  {
+    auto start = Clock::now();
+    op(n);
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+    samples.push_back(static_cast<double>(elapsed) / n);
+  }
+  // the samples vector was reserved, nothing in the loop above allocates but op
+  double ops = static_cast<double>(n) * benchSamples;
+  double cppPerOp = (cppAllocs - cppBefore) / ops;
+  double luaPerOp = (luaAllocs - luaBefore) / ops;
+
+  double mean = 0;
+  for (double v : samples)
+    mean += v;
+  mean /= samples.size();
+  std::sort(samples.begin(), samples.end());
+  benchResults[name].mean = mean;
+
+  char ratio[64] = "null";
+  if (baseline && benchResults.count(baseline))
+    snprintf(ratio, sizeof(ratio), "%.3f", mean / benchResults[baseline].mean);
+
+  printf("{\"name\": \"%s\", \"baseline\": %s%s%s, \"ops\": %.0f, \"ns_per_op\": %.2f, "
+         "\"p50\": %.2f, \"p90\": %.2f, \"p99\": %.2f, \"min\": %.2f, \"max\": %.2f, "
+         "\"allocs_per_op\": %.3f, \"lua_allocs_per_op\": %.3f, \"vs_baseline\": %s}\n",
+         name.c_str(), baseline ? "\"" : "", baseline ? baseline : "null", baseline ? "\"" : "",
+         ops, mean, Percentile(samples, 0.5), Percentile(samples, 0.9), Percentile(samples, 0.99),
+         samples.front(), samples.back(), cppPerOp, luaPerOp, ratio);
+  fflush(stdout);
+}
+
+// LoopChunk
+// compiles `local n = ... for i = 1, n do <body> end` and keeps it in the registry
+static int LoopChunk(lua_State *L, const std::string &body)
+{
+  std::string code = "local n = ... for i = 1, n do " + body + " end";
+  if (luaL_loadstring(L, code.c_str()))
+  {
+    printf("{\"error\": \"%s\"}\n", lua_tostring(L, -1));
+    exit(1);
+  }
+  return luaL_ref(L, LUA_REGISTRYINDEX);
+}
+
+static void RunLoop(lua_State *L, int chunk, size_t n)
+{
+  lua_rawgeti(L, LUA_REGISTRYINDEX, chunk);
+  lua_pushinteger(L, static_cast<lua_Integer>(n));
+  lua_call(L, 1, 0);
+}
+
+// ─── Bound functions ─────────────────────────────────────────────────────────
+
+static int add(int a, int b)
+{
+  return a + b;
+}
+
+static size_t sinkLength = 0;
+static void sink(std::string message)
+{
+  sinkLength += message.size();
+}
+
+static void sinkView(std::string_view message)
+{
+  sinkLength += message.size();
+}
+
+static void sinkRef(const std::string &message)
+{
+  sinkLength += message.size();
+}
+
+static int RawAdd(lua_State *L)
+{
+  lua_pushinteger(L, luaL_checkinteger(L, 1) + luaL_checkinteger(L, 2));
+  return 1;
+}
+
+static int RawSink(lua_State *L)
+{
+  size_t len;
+  luaL_checklstring(L, 1, &len);
+  sinkLength += len;
+  return 0;
+}
+
+// ─── Cases ───────────────────────────────────────────────────────────────────
+
+static void BenchCalls(LuaScript &script)
+{
+  lua_State *L = script.State();
+  lua_register(L, "raw_add", &RawAdd);
+  lua_register(L, "raw_sink", &RawSink);
+  LuaFunction<int(int, int)> luaAdd(add);
+  luaAdd.Register(L, "fn_add");
+  LuaFunction<int(int, int)>::Register<&add>(L, "static_add");
+  auto metrics = std::make_shared<LuaMetrics>();
+  script.setMetrics(metrics);
+  LuaFunction<int(int, int)>::Register<&add>(L, "metered_add");
+  script.setMetrics(nullptr);
+  int offset = 0;
+  LuaFunction<int(int, int)> luaStateful([offset](int a, int b) { return a + b + offset; });
+  luaStateful.Register(L, "stateful_add");
+  LuaFunction<void(std::string)> luaSink(sink);
+  luaSink.Register(L, "fn_sink");
+  LuaFunction<void(std::string_view)>::Register<&sinkView>(L, "view_sink");
+  LuaFunction<void(const std::string &)>::Register<&sinkRef>(L, "ref_sink");
+
+  auto checkAdd = [&script](const char *fn) {
+    return [&script, fn]() { return script.runString(std::string("assert(") + fn + "(20, 22) == 42)"); };
+  };
+
+  int raw = LoopChunk(L, "raw_add(i, 1)");
+  Bench("call/raw_add", nullptr, L, checkAdd("raw_add"), [&](size_t n) { RunLoop(L, raw, n); });
+  int fn = LoopChunk(L, "fn_add(i, 1)");
+  Bench("call/LuaFunction::Register", "call/raw_add", L, checkAdd("fn_add"), [&](size_t n) { RunLoop(L, fn, n); });
+  int st = LoopChunk(L, "static_add(i, 1)");
+  Bench("call/LuaFunction::Register<Fn>", "call/raw_add", L, checkAdd("static_add"), [&](size_t n) { RunLoop(L, st, n); });
+  int mt = LoopChunk(L, "metered_add(i, 1)");
+  Bench("call/LuaFunction::Register<Fn>(metrics)", "call/LuaFunction::Register<Fn>", L, checkAdd("metered_add"), [&](size_t n) { RunLoop(L, mt, n); });
+  int sf = LoopChunk(L, "stateful_add(i, 1)");
+  Bench("call/LuaFunction::Register(stateful)", "call/raw_add", L, checkAdd("stateful_add"), [&](size_t n) { RunLoop(L, sf, n); });
+
+  auto checkSink = [&script](const char *fn) {
+    return [&script, fn]() {
+      sinkLength = 0;
+      return script.runString(std::string(fn) + "('hello')") && sinkLength == 5;
+    };
+  };
+  int rs = LoopChunk(L, "raw_sink('a message that does not fit in sso')");
+  Bench("call/raw_sink(string)", nullptr, L, checkSink("raw_sink"), [&](size_t n) { RunLoop(L, rs, n); });
+  int fs = LoopChunk(L, "fn_sink('a message that does not fit in sso')");
+  Bench("call/LuaFunction(std::string)", "call/raw_sink(string)", L, checkSink("fn_sink"), [&](size_t n) { RunLoop(L, fs, n); });
+  int vs = LoopChunk(L, "view_sink('a message that does not fit in sso')");
+  Bench("call/LuaFunction(std::string_view)", "call/raw_sink(string)", L, checkSink("view_sink"), [&](size_t n) { RunLoop(L, vs, n); });
+  int cs = LoopChunk(L, "ref_sink('a message that does not fit in sso')");
+  Bench("call/LuaFunction(const std::string&)", "call/raw_sink(string)", L, checkSink("ref_sink"), [&](size_t n) { RunLoop(L, cs, n); });
+}
+
+static void BenchLists(LuaScript &script)
+{
+  lua_State *L = script.State();
+  script.runString("numbers = {} for i = 1, 1000 do numbers[i] = i * 0.5 end "
+                   "names = {} for i = 1, 100 do names[i] = 'name' .. i end");
+
+  auto checkNumbers = [](const std::vector<double> &v) {
+    if (v.size() != 1000)
+      return false;
+    for (size_t i = 0; i < v.size(); i++)
+      if (v[i] != (i + 1) * 0.5)
+        return false;
+    return true;
+  };
+
+  Bench("GetList<double>/1000/raw", nullptr, L,
+        [&]() {
+          std::vector<double> v;
+          lua_getglobal(L, "numbers");
+          size_t len = lua_objlen(L, -1);
+          v.reserve(len);
+          for (size_t i = 1; i <= len; i++)
+          {
+            lua_rawgeti(L, -1, static_cast<int>(i));
+            v.push_back(lua_tonumber(L, -1));
+            lua_pop(L, 1);
+          }
+          lua_pop(L, 1);
+          return checkNumbers(v);
+        },
+        [&](size_t n) {
+          for (size_t k = 0; k < n; k++)
+          {
+            std::vector<double> v;
+            lua_getglobal(L, "numbers");
+            size_t len = lua_objlen(L, -1);
+            v.reserve(len);
+            for (size_t i = 1; i <= len; i++)
+            {
+              lua_rawgeti(L, -1, static_cast<int>(i));
+              v.push_back(lua_tonumber(L, -1));
+              lua_pop(L, 1);
+            }
+            lua_pop(L, 1);
+          }
+        });
+  Bench("GetList<double>/1000", "GetList<double>/1000/raw", L,
+        [&]() { return checkNumbers(script.GetList<double>("numbers")); },
+        [&](size_t n) {
+          for (size_t k = 0; k < n; k++)
+            script.GetList<double>("numbers");
+        });
+
+  std::vector<double> buffer(1000);
+  Bench("GetListInto<double>/1000", "GetList<double>/1000/raw", L,
+        [&]() { return script.GetListInto("numbers", buffer.data(), buffer.size()) == 1000 && checkNumbers(buffer); },
+        [&](size_t n) {
+          for (size_t k = 0; k < n; k++)
+            script.GetListInto("numbers", buffer.data(), buffer.size());
+        });
+
+  Bench("GetList<std::string>/100/raw", nullptr, L,
+        [&]() { return true; },
+        [&](size_t n) {
+          for (size_t k = 0; k < n; k++)
+          {
+            std::vector<std::string> v;
+            lua_getglobal(L, "names");
+            size_t len = lua_objlen(L, -1);
+            v.reserve(len);
+            for (size_t i = 1; i <= len; i++)
+            {
+              lua_rawgeti(L, -1, static_cast<int>(i));
+              size_t sl;
+              const char *s = lua_tolstring(L, -1, &sl);
+              v.emplace_back(s, sl);
+              lua_pop(L, 1);
+            }
+            lua_pop(L, 1);
+          }
+        });
+  Bench("GetList<std::string>/100", "GetList<std::string>/100/raw", L,
+        [&]() {
+          std::vector<std::string> v = script.GetList<std::string>("names");
+          return v.size() == 100 && v[0] == "name1" && v[99] == "name100";
+        },
+        [&](size_t n) {
+          for (size_t k = 0; k < n; k++)
+            script.GetList<std::string>("names");
+        });
+
+  std::vector<double> source(1000);
+  for (size_t i = 0; i < source.size(); i++)
+    source[i] = i * 0.25;
+  Bench("SetList<double>/1000/raw", nullptr, L,
+        [&]() { return true; },
+        [&](size_t n) {
+          for (size_t k = 0; k < n; k++)
+          {
+            lua_createtable(L, static_cast<int>(source.size()), 0);
+            for (size_t i = 0; i < source.size(); i++)
+            {
+              lua_pushnumber(L, source[i]);
+              lua_rawseti(L, -2, static_cast<int>(i + 1));
+            }
+            lua_setglobal(L, "out");
+          }
+        });
+  Bench("SetList<double>/1000", "SetList<double>/1000/raw", L,
+        [&]() {
+          script.SetList<double>("out", source);
+          return script.runString("assert(#out == 1000 and out[1] == 0 and out[1000] == 999 * 0.25)");
+        },
+        [&](size_t n) {
+          for (size_t k = 0; k < n; k++)
+            script.SetList<double>("out", source);
+        });
+}
+
+static void BenchMaps(LuaScript &script)
+{
+  lua_State *L = script.State();
+  script.runString("weights = {} for i = 1, 100 do weights['key' .. i] = i end");
+
+  Bench("GetMap<std::string,double>/100/raw", nullptr, L,
+        [&]() { return true; },
+        [&](size_t n) {
+          for (size_t k = 0; k < n; k++)
+          {
+            std::map<std::string, double> m;
+            lua_getglobal(L, "weights");
+            lua_pushnil(L);
+            while (lua_next(L, -2))
+            {
+              size_t sl;
+              const char *s = lua_tolstring(L, -2, &sl);
+              m[std::string(s, sl)] = lua_tonumber(L, -1);
+              lua_pop(L, 1);
+            }
+            lua_pop(L, 1);
+          }
+        });
+  Bench("GetMap<std::string,double>/100", "GetMap<std::string,double>/100/raw", L,
+        [&]() {
+          std::map<std::string, double> m = script.GetMap<std::string, double>("weights");
+          return m.size() == 100 && m["key1"] == 1 && m["key100"] == 100;
+        },
+        [&](size_t n) {
+          for (size_t k = 0; k < n; k++)
+            script.GetMap<std::string, double>("weights");
+        });
+
+  // a config-sized map, the container is picked by the caller
+  script.runString("config = {} for i = 1, 10000 do config['setting.' .. i] = i end");
+  auto checkConfig = [](const auto &m) { return m.size() == 10000 && m.find(std::string_view("setting.77"))->second == 77; };
+  Bench("GetMap<std::string,double>/10k/raw", nullptr, L,
+        [&]() { return true; },
+        [&](size_t n) {
+          for (size_t k = 0; k < n; k++)
+          {
+            std::map<std::string, double> m;
+            lua_getglobal(L, "config");
+            lua_pushnil(L);
+            while (lua_next(L, -2))
+            {
+              size_t sl;
+              const char *s = lua_tolstring(L, -2, &sl);
+              m[std::string(s, sl)] = lua_tonumber(L, -1);
+              lua_pop(L, 1);
+            }
+            lua_pop(L, 1);
+          }
+        });
+  Bench("GetMap<std::string,double>/10k", "GetMap<std::string,double>/10k/raw", L,
+        [&]() {
+          std::map<std::string, double> m = script.GetMap<std::string, double>("config");
+          return m.size() == 10000 && m["setting.77"] == 77;
+        },
+        [&](size_t n) {
+          for (size_t k = 0; k < n; k++)
+            script.GetMap<std::string, double>("config");
+        });
+  Bench("GetUnorderedMap<std::string,double>/10k", "GetMap<std::string,double>/10k/raw", L,
+        [&]() {
+          auto m = script.GetUnorderedMap<std::string, double>("config");
+          return m.size() == 10000 && m.at("setting.77") == 77;
+        },
+        [&](size_t n) {
+          for (size_t k = 0; k < n; k++)
+            script.GetUnorderedMap<std::string, double>("config");
+        });
+  Bench("GetFlatMap<std::string,double>/10k", "GetMap<std::string,double>/10k/raw", L,
+        [&]() { return checkConfig(script.GetFlatMap<std::string, double>("config")); },
+        [&](size_t n) {
+          for (size_t k = 0; k < n; k++)
+            script.GetFlatMap<std::string, double>("config");
+        });
+  Bench("GetFlatMap<std::string_view,double>/10k", "GetMap<std::string,double>/10k/raw", L,
+        [&]() { return checkConfig(script.GetFlatMap<std::string_view, double>("config")); },
+        [&](size_t n) {
+          for (size_t k = 0; k < n; k++)
+            script.GetFlatMap<std::string_view, double>("config");
+        });
+
+  std::map<std::string, double> source;
+  for (int i = 1; i <= 100; i++)
+    source["key" + std::to_string(i)] = i;
+  Bench("SetMap<std::string,double>/100/raw", nullptr, L,
+        [&]() { return true; },
+        [&](size_t n) {
+          for (size_t k = 0; k < n; k++)
+          {
+            lua_createtable(L, 0, static_cast<int>(source.size()));
+            for (const auto &kv : source)
+            {
+              lua_pushlstring(L, kv.first.c_str(), kv.first.size());
+              lua_pushnumber(L, kv.second);
+              lua_rawset(L, -3);
+            }
+            lua_setglobal(L, "outmap");
+          }
+        });
+  Bench("SetMap<std::string,double>/100", "SetMap<std::string,double>/100/raw", L,
+        [&]() {
+          script.SetMap<std::string, double>("outmap", source);
+          return script.runString("local n = 0 for k, v in pairs(outmap) do n = n + 1 end "
+                                  "assert(n == 100 and outmap.key7 == 7)");
+        },
+        [&](size_t n) {
+          for (size_t k = 0; k < n; k++)
+            script.SetMap<std::string, double>("outmap", source);
+        });
+}
+
+static void BenchGlobals(LuaScript &script)
+{
+  lua_State *L = script.State();
+  script.runString("config = { window = { size = { width = 640 } } }");
+
+  Bench("global_get<int>(dotted)/raw", nullptr, L,
+        [&]() { return true; },
+        [&](size_t n) {
+          for (size_t k = 0; k < n; k++)
+          {
+            lua_getglobal(L, "config");
+            lua_getfield(L, -1, "window");
+            lua_getfield(L, -1, "size");
+            lua_getfield(L, -1, "width");
+            volatile int width = static_cast<int>(lua_tointeger(L, -1));
+            (void)width;
+            lua_pop(L, 4);
+          }
+        });
+  Bench("global_get<int>(dotted)", "global_get<int>(dotted)/raw", L,
+        [&]() { return script.global_get<int>("config.window.size.width") == 640; },
+        [&](size_t n) {
+          for (size_t k = 0; k < n; k++)
+            script.global_get<int>("config.window.size.width");
+        });
+
+  LuaPath width("config.window.size.width");
+  Bench("global_get<int>(LuaPath)", "global_get<int>(dotted)/raw", L,
+        [&]() { return script.global_get<int>(width) == 640; },
+        [&](size_t n) {
+          for (size_t k = 0; k < n; k++)
+            script.global_get<int>(width);
+        });
+
+  const std::string chunk = "local x = 0 for i = 1, 10 do x = x + i end";
+  Bench("runString/raw", nullptr, L,
+        [&]() { return true; },
+        [&](size_t n) {
+          for (size_t k = 0; k < n; k++)
+          {
+            if (luaL_loadstring(L, chunk.c_str()) || lua_pcall(L, 0, 0, 0))
+              lua_pop(L, 1);
+          }
+        });
+  Bench("runString", "runString/raw", L,
+        [&]() { return script.runString(chunk); },
+        [&](size_t n) {
+          for (size_t k = 0; k < n; k++)
+            script.runString(chunk);
+        });
+
+  LuaChunk compiled = script.compile(chunk);
+  Bench("LuaChunk::run", "runString/raw", L,
+        [&]() { return compiled.run(); },
+        [&](size_t n) {
+          for (size_t k = 0; k < n; k++)
+            compiled.run();
+        });
+
+  script.setChunkCache(std::make_shared<LuaChunkCache>());
+  Bench("runString(LuaChunkCache)", "runString/raw", L,
+        [&]() { return script.runString(chunk) && script.runString(chunk) && script.getChunkCache()->stats().hits > 0; },
+        [&](size_t n) {
+          for (size_t k = 0; k < n; k++)
+            script.runString(chunk);
+        });
+  script.setChunkCache(nullptr);
+
+  script.runString("function lerp(a, b, t) return a + (b - a) * t end");
+  const std::vector<double> args = {10.0, 20.0, 0.5};
+  Bench("LuaCall<double>/raw", nullptr, L,
+        [&]() { return true; },
+        [&](size_t n) {
+          for (size_t k = 0; k < n; k++)
+          {
+            lua_getglobal(L, "lerp");
+            for (double a : args)
+              lua_pushnumber(L, a);
+            if (lua_pcall(L, static_cast<int>(args.size()), 1, 0) == 0)
+            {
+              volatile double r = lua_tonumber(L, -1);
+              (void)r;
+            }
+            lua_pop(L, 1);
+          }
+        });
+  Bench("LuaCall<double>", "LuaCall<double>/raw", L,
+        [&]() { return LuaCall<double>(L, "lerp", args) == 15.0; },
+        [&](size_t n) {
+          for (size_t k = 0; k < n; k++)
+            LuaCall<double>(L, "lerp", args);
+        });
+  Bench("LuaCall<double>(args...)", "LuaCall<double>/raw", L,
+        [&]() { return LuaCall<double>(L, "lerp", 10.0, 20.0, 0.5) == 15.0; },
+        [&](size_t n) {
+          for (size_t k = 0; k < n; k++)
+            LuaCall<double>(L, "lerp", 10.0, 20.0, 0.5);
+        });
+
+  script.runString("function score(id, weight) return id * weight + 1 end");
+  std::vector<std::tuple<int, double>> items;
+  for (int i = 0; i < 1000; i++)
+    items.emplace_back(i, 0.5);
+  std::vector<double> scores(items.size());
+  Bench("batch/LuaCall/1000", nullptr, L,
+        [&]() { return LuaCall<double>(L, "score", 4, 0.5) == 3.0; },
+        [&](size_t n) {
+          for (size_t k = 0; k < n; k++)
+            for (size_t i = 0; i < items.size(); i++)
+              scores[i] = LuaCall<double>(L, "score", std::get<0>(items[i]), std::get<1>(items[i]));
+        });
+  LuaBatch<double(int, double)> score(L, "score");
+  Bench("batch/LuaBatch/1000", "batch/LuaCall/1000", L,
+        [&]() { return score.run(items, scores.data()) && scores[999] == 500.5; },
+        [&](size_t n) {
+          for (size_t k = 0; k < n; k++)
+            score.run(items, scores.data());
+        });
+
+  script.runString("function minmax(a, b) if a < b then return a, b end return b, a end "
+                   "function minmax_table(a, b) if a < b then return { a, b } end return { b, a } end");
+  Bench("LuaCall<tuple>/table", nullptr, L,
+        [&]() { return true; },
+        [&](size_t n) {
+          for (size_t k = 0; k < n; k++)
+          {
+            lua_getglobal(L, "minmax_table");
+            lua_pushnumber(L, 2.0);
+            lua_pushnumber(L, 1.0);
+            if (lua_pcall(L, 2, 1, 0) == 0)
+            {
+              lua_rawgeti(L, -1, 1);
+              lua_rawgeti(L, -2, 2);
+              volatile double lo = lua_tonumber(L, -2), hi = lua_tonumber(L, -1);
+              (void)lo;
+              (void)hi;
+              lua_pop(L, 2);
+            }
+            lua_pop(L, 1);
+          }
+        });
+  Bench("LuaCall<tuple>", "LuaCall<tuple>/table", L,
+        [&]() { return LuaCall<std::tuple<double, double>>(L, "minmax", 2.0, 1.0) == std::make_tuple(1.0, 2.0); },
+        [&](size_t n) {
+          for (size_t k = 0; k < n; k++)
+            LuaCall<std::tuple<double, double>>(L, "minmax", 2.0, 1.0);
+        });
+}
+
+// ─── Classes ─────────────────────────────────────────────────────────────────
+
+struct BenchVec
+{
+  double x = 0, y = 0;
+  BenchVec(double x, double y) : x(x), y(y) {}
+  double dot(double ox, double oy) const { return x * ox + y * oy; }
+};
+
+static void BenchClasses(LuaScript &script)
+{
+  lua_State *L = script.State();
+  LuaClass<BenchVec>(L, "BenchVec").constructor<double, double>().method<&BenchVec::dot>("dot").property<&BenchVec::x>("x");
+  script.runString("bench_vec = BenchVec.new(3, 4)");
+
+  int method = LoopChunk(L, "bench_vec:dot(i, 1)");
+  Bench("class/method", "call/raw_add", L,
+        [&]() { return script.runString("assert(bench_vec:dot(2, 1) == 10)"); },
+        [&](size_t n) { RunLoop(L, method, n); });
+  int get = LoopChunk(L, "local x = bench_vec.x");
+  Bench("class/property_get", nullptr, L,
+        [&]() { return script.runString("assert(bench_vec.x == 3)"); },
+        [&](size_t n) { RunLoop(L, get, n); });
+  int set = LoopChunk(L, "bench_vec.x = i");
+  Bench("class/property_set", nullptr, L,
+        [&]() { return script.runString("bench_vec.x = 3 assert(bench_vec.x == 3)"); },
+        [&](size_t n) { RunLoop(L, set, n); });
+  int ctor = LoopChunk(L, "local v = BenchVec.new(i, 1)");
+  Bench("class/new", nullptr, L,
+        [&]() { return script.runString("assert(BenchVec.new(1, 2):dot(1, 1) == 3)"); },
+        [&](size_t n) { RunLoop(L, ctor, n); });
+}
+
+// ─── Buffers ─────────────────────────────────────────────────────────────────
+
+static void BenchBuffers(LuaScript &script)
+{
+  lua_State *L = script.State();
+  // one op lets a script touch every 100th of 100k samples, the host sees the result
+  std::vector<double> samples(100000, 2.0);
+  LuaChunk touch = script.compile("for i = 100, #signal, 100 do signal[i] = signal[i] * 0.5 end");
+  auto touched = [&samples]() { return samples[99] == 1.0 && samples[100] == 2.0; };
+  Bench("buffer/touch/100k/SetList+GetList", nullptr, L,
+        [&]() {
+          script.SetList("signal", samples);
+          touch.run();
+          return script.GetListInto("signal", samples.data(), samples.size()) == samples.size() && touched();
+        },
+        [&](size_t n) {
+          for (size_t k = 0; k < n; k++)
+          {
+            script.SetList("signal", samples);
+            touch.run();
+            script.GetListInto("signal", samples.data(), samples.size());
+          }
+        });
+  std::fill(samples.begin(), samples.end(), 2.0);
+  LuaBuffer<double>::push(L, samples);
+  lua_setglobal(L, "signal");
+  Bench("buffer/touch/100k/LuaBuffer", "buffer/touch/100k/SetList+GetList", L,
+        [&]() { return touch.run() && touched(); },
+        [&](size_t n) {
+          for (size_t k = 0; k < n; k++)
+            touch.run();
+        });
+  script.runString("signal = nil");
+}
+
+// ─── Structs ─────────────────────────────────────────────────────────────────
+
+struct BenchVec3
+{
+  double x, y, z;
+};
+
+struct BenchRecord
+{
+  int id;
+  BenchVec3 pos;
+  double health;
+};
+
+LUA_STRUCT(BenchVec3, LUA_FIELD(x), LUA_FIELD(y), LUA_FIELD(z));
+LUA_STRUCT(BenchRecord, LUA_FIELD(id), LUA_FIELD(pos), LUA_FIELD(health));
+
+static void BenchStructs(LuaScript &script)
+{
+  lua_State *L = script.State();
+  // one op sends 1000 records to lua and reads them back
+  std::vector<BenchRecord> records(1000);
+  for (size_t i = 0; i < records.size(); i++)
+    records[i] = BenchRecord{static_cast<int>(i), BenchVec3{double(i), 1, 2}, 100};
+  std::vector<BenchRecord> back;
+  auto same = [&]() { return back.size() == records.size() && back[999].id == 999 && back[999].pos.x == 999 && back[5].health == 100; };
+  Bench("struct/1000/raw", nullptr, L,
+        [&]() { return true; },
+        [&](size_t n) {
+          for (size_t k = 0; k < n; k++)
+          {
+            lua_createtable(L, static_cast<int>(records.size()), 0);
+            int i = 0;
+            for (const BenchRecord &r : records)
+            {
+              lua_createtable(L, 0, 3);
+              lua_pushinteger(L, r.id);
+              lua_setfield(L, -2, "id");
+              lua_createtable(L, 0, 3);
+              lua_pushnumber(L, r.pos.x);
+              lua_setfield(L, -2, "x");
+              lua_pushnumber(L, r.pos.y);
+              lua_setfield(L, -2, "y");
+              lua_pushnumber(L, r.pos.z);
+              lua_setfield(L, -2, "z");
+              lua_setfield(L, -2, "pos");
+              lua_pushnumber(L, r.health);
+              lua_setfield(L, -2, "health");
+              lua_rawseti(L, -2, ++i);
+            }
+            back.resize(lua_objlen(L, -1));
+            for (size_t j = 0; j < back.size(); j++)
+            {
+              lua_rawgeti(L, -1, static_cast<int>(j) + 1);
+              lua_getfield(L, -1, "id");
+              back[j].id = static_cast<int>(lua_tointeger(L, -1));
+              lua_getfield(L, -2, "pos");
+              lua_getfield(L, -1, "x");
+              back[j].pos.x = lua_tonumber(L, -1);
+              lua_getfield(L, -2, "y");
+              back[j].pos.y = lua_tonumber(L, -1);
+              lua_getfield(L, -3, "z");
+              back[j].pos.z = lua_tonumber(L, -1);
+              lua_getfield(L, -6, "health");
+              back[j].health = lua_tonumber(L, -1);
+              lua_pop(L, 7);
+            }
+            lua_pop(L, 1);
+          }
+        });
+  Bench("struct/1000/LuaStruct", "struct/1000/raw", L,
+        [&]() {
+          back.clear();
+          LuaStack<std::vector<BenchRecord>>::push(L, records);
+          back = LuaStack<std::vector<BenchRecord>>::get(L, -1);
+          lua_pop(L, 1);
+          return same();
+        },
+        [&](size_t n) {
+          for (size_t k = 0; k < n; k++)
+          {
+            LuaStack<std::vector<BenchRecord>>::push(L, records);
+            LuaStructGet(L, -1, back);
+            lua_pop(L, 1);
+          }
+        });
+}
+
+// ─── Serialization ───────────────────────────────────────────────────────────
+
+static void BenchSerializer(LuaScript &script)
+{
+  lua_State *L = script.State();
+  // the usual lua-side serializer, builds loadable source with table.concat
+  script.runString(R"(
+    records = {}
+    for i = 1, 1000 do records[i] = { id = i, name = 'item' .. i, tags = { 'a', 'b' }, pos = { x = i * 0.5, y = -i } } end
+    function lua_serialize(v, out)
+      local t = type(v)
+      if t == 'table' then
+        out[#out + 1] = '{'
+        for k, x in pairs(v) do
+          out[#out + 1] = '['
+          lua_serialize(k, out)
+          out[#out + 1] = ']='
+          lua_serialize(x, out)
+          out[#out + 1] = ','
+        end
+        out[#out + 1] = '}'
+      elseif t == 'string' then
+        out[#out + 1] = string.format('%q', v)
+      else
+        out[#out + 1] = tostring(v)
+      end
+      return out
+    end
+  )");
+  LuaChunk luaSave = script.compile("return table.concat(lua_serialize(records, {}))");
+  Bench("serialize/save/1000/lua", nullptr, L,
+        [&]() { return luaSave.call<std::string>().size() > 0; },
+        [&](size_t n) {
+          for (size_t k = 0; k < n; k++)
+            luaSave.call<std::string>();
+        });
+  LuaSerializer serializer;
+  std::string blob;
+  auto save = [&]() {
+    blob.clear();
+    lua_getglobal(L, "records");
+    bool ok = serializer.save(L, -1, blob);
+    lua_pop(L, 1);
+    return ok;
+  };
+  Bench("serialize/save/1000/LuaSerializer", "serialize/save/1000/lua", L, save,
+        [&](size_t n) {
+          for (size_t k = 0; k < n; k++)
+            save();
+        });
+
+  std::string source = "return " + luaSave.call<std::string>();
+  Bench("serialize/load/1000/loadstring", nullptr, L,
+        [&]() { return luaL_dostring(L, source.c_str()) == 0 && lua_istable(L, -1) && (lua_pop(L, 1), true); },
+        [&](size_t n) {
+          for (size_t k = 0; k < n; k++)
+          {
+            luaL_dostring(L, source.c_str());
+            lua_pop(L, 1);
+          }
+        });
+  Bench("serialize/load/1000/LuaSerializer", "serialize/load/1000/loadstring", L,
+        [&]() { return serializer.load(L, blob) && lua_objlen(L, -1) == 1000 && (lua_pop(L, 1), true); },
+        [&](size_t n) {
+          for (size_t k = 0; k < n; k++)
+          {
+            serializer.load(L, blob);
+            lua_pop(L, 1);
+          }
+        });
+}
+
+// ─── Scheduler ───────────────────────────────────────────────────────────────
+
+static void BenchScheduler(LuaScript &script)
+{
+  lua_State *L = script.State();
+  LuaScheduler scheduler(L);
+  scheduler.registerGlobals();
+  LuaChunk task = script.compile("local x = ... return x + 1");
+  Bench("scheduler/spawn+finish", "LuaChunk::run", L,
+        [&]() { return scheduler.spawn(task.reference(), 1) && scheduler.step() == 1 && scheduler.empty(); },
+        [&](size_t n) {
+          for (size_t k = 0; k < n; k++)
+            scheduler.spawn(task.reference(), 1);
+          scheduler.step();
+        });
+  // one resume of a suspended script per op
+  scheduler.spawn("while true do yield() end");
+  Bench("scheduler/resume", nullptr, L,
+        [&]() { return scheduler.step() == 1 && scheduler.size() == 1; },
+        [&](size_t n) {
+          for (size_t k = 0; k < n; k++)
+            scheduler.step();
+        });
+}
+
+// ─── Budgets ─────────────────────────────────────────────────────────────────
+
+static void BenchBudget(LuaScript &script)
+{
+  const std::string loop = "local x = 0 for i = 1, 10000 do x = x + i end return x";
+  LuaChunk plain = script.compile(loop);
+  Bench("budget/unmetered loop", nullptr, script.State(),
+        [&]() { return plain.run(); },
+        [&](size_t n) {
+          for (size_t k = 0; k < n; k++)
+            plain.run();
+        });
+  // same loop in a state with a count hook firing every 1000 instructions
+  LuaScript metered(std::make_unique<LuaPoolAllocator>());
+  LuaBudget budget;
+  budget.instructions = 1000000;
+  metered.setBudget(budget);
+  LuaChunk hooked = metered.compile(loop);
+  Bench("budget/hooked loop", "budget/unmetered loop", metered.State(),
+        [&]() { return hooked.run() && !metered.BudgetExceeded(); },
+        [&](size_t n) {
+          for (size_t k = 0; k < n; k++)
+            hooked.run();
+        });
+}
+
+// ─── Profiler ────────────────────────────────────────────────────────────────
+
+static void BenchProfiler(LuaScript &script)
+{
+  lua_State *L = script.State();
+  LuaFunction<int(int, int)>::Register<&add>(L, "profiled_add");
+  LuaChunk loop = script.compile("local x = 0 for i = 1, 1000 do x = profiled_add(x, i) end return x");
+  Bench("profiler/off", nullptr, L,
+        [&]() { return loop.run(); },
+        [&](size_t n) {
+          for (size_t k = 0; k < n; k++)
+            loop.run();
+        });
+  // every binding call is timed and a sample is taken every 1000 instructions
+  script.startProfiler();
+  Bench("profiler/on", "profiler/off", L,
+        [&]() { return loop.run(); },
+        [&](size_t n) {
+          for (size_t k = 0; k < n; k++)
+            loop.run();
+        });
+  script.stopProfiler();
+}
+
+// ─── Allocators ──────────────────────────────────────────────────────────────
+
+static void BenchAllocators(LuaScript &script)
+{
+  lua_State *L = script.State();
+  // one op opens a state, churns small tables and strings, and closes it
+  const std::string chunk = "local t = {} for i = 1, 200 do t[i] = { x = i, name = 'n' .. i } end";
+  auto churn = [&chunk](LuaScript &s) { return s.runString(chunk); };
+
+  Bench("state/luaL_newstate", nullptr, L,
+        [&]() { LuaScript s(luaL_newstate()); return churn(s); },
+        [&](size_t n) {
+          for (size_t k = 0; k < n; k++)
+          {
+            LuaScript s(luaL_newstate());
+            churn(s);
+          }
+        });
+  Bench("state/LuaMallocAllocator", "state/luaL_newstate", L,
+        [&]() { LuaScript s(std::make_unique<LuaMallocAllocator>()); return churn(s) && s.AllocStats()->peakBytes > 0; },
+        [&](size_t n) {
+          for (size_t k = 0; k < n; k++)
+          {
+            LuaScript s(std::make_unique<LuaMallocAllocator>());
+            churn(s);
+          }
+        });
+  Bench("state/LuaPoolAllocator", "state/luaL_newstate", L,
+        [&]() { LuaScript s(std::make_unique<LuaPoolAllocator>()); return churn(s) && s.AllocStats()->peakBytes > 0; },
+        [&](size_t n) {
+          for (size_t k = 0; k < n; k++)
+          {
+            LuaScript s(std::make_unique<LuaPoolAllocator>());
+            churn(s);
+          }
+        });
+}
+
+// ─── State pool ──────────────────────────────────────────────────────────────
+
+static void BenchPool(LuaScript &script)
+{
+  LuaStatePool::Options options;
+  options.size = 4;
+  options.threadAffinity = true;
+  options.warmup = [](LuaScript &s) { LuaFunction<int(int, int)>::Register<add>(s.State(), "add"); };
+  LuaStatePool pool(options);
+  Bench("pool/checkout+checkin", nullptr, script.State(),
+        [&]() { return pool.checkout()->State() != nullptr; },
+        [&](size_t n) {
+          for (size_t k = 0; k < n; k++)
+            pool.checkout();
+        });
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc > 1 && argv[1][0] != '\0')
+    benchFilter = argv[1];
+  if (argc > 2)
+    benchSamples = std::max(1, atoi(argv[2]));
+
+  // errors of the bindings under test are reported by the validation step
+  LuaLog::setSink(nullptr);
+
+  LuaScript script(lua_newstate(&CountingAlloc, nullptr));
+  BenchCalls(script);
+  BenchLists(script);
+  BenchMaps(script);
+  BenchGlobals(script);
+  BenchClasses(script);
+  BenchBuffers(script);
+  BenchStructs(script);
+  BenchSerializer(script);
+  BenchScheduler(script);
+  BenchBudget(script);
+  BenchProfiler(script);
+  BenchAllocators(script);
+  BenchPool(script);
+  return 0;
+}
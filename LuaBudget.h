@@ -0,0 +1,304 @@
+// Copyright (C) 2023 Theros < MisModding | SvalTek >
+//
+// This file is part of LuaBinder.
+//
+// LuaBinder is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LuaBinder is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LuaBinder.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+#include "Lua.hpp"
+#include <chrono>
+#include <cstdint>
+
+// ─── LuaBudget ───────────────────────────────────────────────────────────────
+
+// struct LuaBudget
+// Execution limit for one invocation (a runString, a LuaChunk run, or one
+// resume of a scheduled task). Enforced by a count hook, so instructions are
+// counted in steps of hookInterval and the wall clock is read once per step.
+struct LuaBudget
+{
+  enum Action
+  {
+    Abort, // raise a lua error, the invocation fails
+    Yield, // yield back to the LuaScheduler, aborts outside a scheduled task or in a coroutine of it
+  };
+
+  uint64_t instructions = 0;                // 0 for no instruction limit
+  std::chrono::microseconds wallTime{0};    // 0 for no time limit
+  Action action = Abort;
+  int hookInterval = 1000;                  // vm instructions between checks
+
+  bool limited() const { return instructions != 0 || wallTime.count() != 0; }
+};
+
+// struct LuaBudgetUsage
+// accounting kept per script or task
+struct LuaBudgetUsage
+{
+  uint64_t instructions = 0;                       // counted in hookInterval steps
+  std::chrono::steady_clock::duration wallTime{0}; // time spent inside invocations
+  size_t invocations = 0;
+  size_t exceeded = 0;                             // invocations stopped by the budget
+};
+
+// class LuaBudgetMeter
+// Tracks one script or task against a LuaBudget. attach() installs the
+// count hook on a lua thread, begin()/end() bracket every invocation.
+// Nested begin()/end() pairs, e.g. a binding that runs another chunk of the
+// same script, count as part of the outermost invocation.
+// Once the budget is exceeded the hook fires on every instruction and raises
+// (or yields) again each time, so a pcall in the script can't swallow it;
+// the hook interval is put back when the outermost invocation ends.
+// Threads created from a hooked thread inherit the hook. Code on a thread
+// without a meter of its own, e.g. a coroutine the script created, is
+// charged to the meter of the invocation running at the time.
+class LuaBudgetMeter
+{
+public:
+  using Clock = std::chrono::steady_clock;
+
+  LuaBudgetMeter() = default;
+  explicit LuaBudgetMeter(const LuaBudget &budget) : limits(budget) {}
+  ~LuaBudgetMeter() { detach(); }
+
+  LuaBudgetMeter(const LuaBudgetMeter &) = delete;
+  LuaBudgetMeter &operator=(const LuaBudgetMeter &) = delete;
+
+  void setBudget(const LuaBudget &budget) { limits = budget; }
+  const LuaBudget &budget() const { return limits; }
+
+  /** Meter the code running on thread L */
+  void attach(lua_State *L)
+  {
+    detach();
+    thread = L;
+    tightened = false;
+    Meters(L);
+    lua_pushlightuserdata(L, L);
+    lua_pushlightuserdata(L, this);
+    lua_rawset(L, -3);
+    lua_pop(L, 1);
+    if (limits.limited())
+      lua_sethook(L, &Hook, LUA_MASKCOUNT, limits.hookInterval > 0 ? limits.hookInterval : 1000);
+  }
+
+  void detach()
+  {
+    if (!thread)
+      return;
+    lua_sethook(thread, nullptr, 0, 0);
+    tightened = false;
+    Meters(thread);
+    lua_pushlightuserdata(thread, thread);
+    lua_pushnil(thread);
+    lua_rawset(thread, -3);
+    lua_pop(thread, 1);
+    thread = nullptr;
+  }
+
+  /** Start an invocation, the budget applies from here */
+  void begin()
+  {
+    if (depth++ > 0)
+      return;
+    if (thread)
+    {
+      // coroutines without a meter are charged to this one until end()
+      Meters(thread);
+      lua_pushlightuserdata(thread, const_cast<char *>(&ActiveKey));
+      lua_rawget(thread, -2);
+      outer = static_cast<LuaBudgetMeter *>(lua_touserdata(thread, -1));
+      lua_pop(thread, 1);
+      lua_pushlightuserdata(thread, const_cast<char *>(&ActiveKey));
+      lua_pushlightuserdata(thread, this);
+      lua_rawset(thread, -3);
+      lua_pop(thread, 1);
+    }
+    stopped = false;
+    spent = 0;
+    start = Clock::now();
+    deadline = limits.wallTime.count() ? start + limits.wallTime : Clock::time_point::max();
+    totals.invocations++;
+  }
+
+  /** End an invocation */
+  void end()
+  {
+    if (depth == 0 || --depth > 0)
+      return;
+    if (thread)
+    {
+      if (tightened)
+      {
+        tightened = false;
+        lua_sethook(thread, lua_gethook(thread), lua_gethookmask(thread), interval);
+      }
+      Meters(thread);
+      // put back the hook count of the coroutines tightened by Hook
+      lua_pushlightuserdata(thread, this);
+      lua_rawget(thread, -2);
+      if (lua_istable(thread, -1))
+      {
+        for (lua_pushnil(thread); lua_next(thread, -2); lua_pop(thread, 1))
+        {
+          lua_State *co = lua_tothread(thread, -2);
+          lua_sethook(co, lua_gethook(co), lua_gethookmask(co), static_cast<int>(lua_tointeger(thread, -1)));
+        }
+        lua_pushlightuserdata(thread, this);
+        lua_pushnil(thread);
+        lua_rawset(thread, -4);
+      }
+      lua_pop(thread, 1);
+      lua_pushlightuserdata(thread, const_cast<char *>(&ActiveKey));
+      lua_pushlightuserdata(thread, outer);
+      lua_rawset(thread, -3);
+      lua_pop(thread, 1);
+      outer = nullptr;
+    }
+    totals.wallTime += Clock::now() - start;
+    if (stopped)
+      totals.exceeded++;
+  }
+
+  /** Check if the last invocation was stopped by the budget */
+  bool exceeded() const { return stopped; }
+
+  const LuaBudgetUsage &usage() const { return totals; }
+  void resetUsage() { totals = LuaBudgetUsage(); }
+
+  // Scope
+  // begin()/end() around one invocation, a null meter does nothing
+  struct Scope
+  {
+    explicit Scope(LuaBudgetMeter *meter) : meter(meter)
+    {
+      if (meter)
+        meter->begin();
+    }
+    ~Scope()
+    {
+      if (meter)
+        meter->end();
+    }
+    LuaBudgetMeter *meter;
+  };
+
+private:
+  static constexpr const char *RegistryKey = "LuaBinder.LuaBudget";
+  static constexpr char ActiveKey = 0;
+
+  // pushes registry[RegistryKey], the thread -> meter table, it also holds
+  // the meter of the running invocation at ActiveKey and the coroutines a
+  // stopped meter tightened at the meter
+  static void Meters(lua_State *L)
+  {
+    lua_getfield(L, LUA_REGISTRYINDEX, RegistryKey);
+    if (!lua_istable(L, -1))
+    {
+      lua_pop(L, 1);
+      lua_newtable(L);
+      lua_pushvalue(L, -1);
+      lua_setfield(L, LUA_REGISTRYINDEX, RegistryKey);
+    }
+  }
+
+  static void Hook(lua_State *L, lua_Debug *)
+  {
+    Meters(L);
+    lua_pushlightuserdata(L, L);
+    lua_rawget(L, -2);
+    LuaBudgetMeter *meter = static_cast<LuaBudgetMeter *>(lua_touserdata(L, -1));
+    if (!meter)
+    {
+      lua_pushlightuserdata(L, const_cast<char *>(&ActiveKey));
+      lua_rawget(L, -3);
+      meter = static_cast<LuaBudgetMeter *>(lua_touserdata(L, -1));
+      lua_pop(L, 1);
+    }
+    lua_pop(L, 2);
+    if (!meter || meter->depth == 0)
+      return;
+
+    if (!meter->stopped)
+    {
+      uint64_t step = static_cast<uint64_t>(meter->limits.hookInterval > 0 ? meter->limits.hookInterval : 1000);
+      meter->spent += step;
+      meter->totals.instructions += step;
+      bool over = (meter->limits.instructions && meter->spent > meter->limits.instructions) || Clock::now() > meter->deadline;
+      if (!over)
+        return;
+
+      meter->stopped = true;
+      if (meter->thread && meter->thread != L)
+        meter->Tighten(meter->thread);
+    }
+    if (lua_gethookcount(L) != 1)
+      meter->Tighten(L);
+
+    bool mainThread = lua_pushthread(L) != 0;
+    lua_pop(L, 1);
+    // a coroutine of the script would only yield to the script, it fails instead
+    if (meter->limits.action == LuaBudget::Yield && !mainThread && L == meter->thread)
+    {
+      // the scheduler resumes the task with a fresh budget
+      lua_yield(L, 0);
+      return;
+    }
+    luaL_error(L, "execution budget exceeded");
+  }
+
+  // Keeps the hook (a profiler may chain to it) but checks every instruction
+  // on L until end(). Other threads than the metered one are held in the
+  // meters table with their hook count so end() can put it back.
+  void Tighten(lua_State *L)
+  {
+    if (L == thread)
+    {
+      if (tightened)
+        return;
+      tightened = true;
+      interval = lua_gethookcount(L);
+    }
+    else
+    {
+      Meters(L);
+      lua_pushlightuserdata(L, this);
+      lua_rawget(L, -2);
+      if (!lua_istable(L, -1))
+      {
+        lua_pop(L, 1);
+        lua_newtable(L);
+        lua_pushlightuserdata(L, this);
+        lua_pushvalue(L, -2);
+        lua_rawset(L, -4);
+      }
+      lua_pushthread(L);
+      lua_pushinteger(L, lua_gethookcount(L));
+      lua_rawset(L, -3);
+      lua_pop(L, 2);
+    }
+    lua_sethook(L, lua_gethook(L), lua_gethookmask(L), 1);
+  }
+
+  LuaBudget limits;
+  LuaBudgetUsage totals;
+  lua_State *thread = nullptr;
+  int depth = 0;         // nested begin() calls
+  bool stopped = false;
+  bool tightened = false; // hook count lowered to 1 after stopping
+  int interval = 0;       // hook count to restore
+  LuaBudgetMeter *outer = nullptr; // the running meter begin() replaced
+  uint64_t spent = 0;
+  Clock::time_point start;
+  Clock::time_point deadline = Clock::time_point::max();
+};
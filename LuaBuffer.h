@@ -0,0 +1,314 @@
+// Copyright (C) 2023 Theros < MisModding | SvalTek >
+//
+// This file is part of LuaBinder.
+//
+// LuaBinder is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LuaBinder is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LuaBinder.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+#include "LuaClass.h"
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include <typeinfo>
+#include <vector>
+
+// ─── LuaBuffer ───────────────────────────────────────────────────────────────
+
+// struct LuaBufferView
+// the memory behind a LuaBuffer as seen from C++
+template <typename T>
+struct LuaBufferView
+{
+  T *data = nullptr;
+  size_t size = 0;
+  bool readOnly = false;
+
+  T *begin() const { return data; }
+  T *end() const { return data + size; }
+  T &operator[](size_t i) const { return data[i]; }
+  explicit operator bool() const { return data != nullptr; }
+};
+
+// class LuaBuffer
+// A typed array userdata over contiguous C++ memory. Scripts index it like
+// a list, 1-based, and every read and write goes straight to the memory:
+//
+//   std::vector<double> samples(1 << 20);
+//   LuaBuffer<double>::push(L, samples);
+//   lua_setglobal(L, "samples");
+//
+//   for i = 1, #samples do samples[i] = samples[i] * 0.5 end
+//
+// Arithmetic elements read and write as numbers (bool as booleans), a number
+// the element type can't hold raises a lua error. Other element types must
+// be bound with LuaClass: reading an element gives a borrowed object pointing
+// into the buffer (a copy for a read-only view), writing copies an object in. Indices outside [1, #buffer]
+// raise a lua error. An element object read from a buffer owned by lua keeps
+// the buffer alive; one read from a pushed view points into the caller's
+// memory and must not be kept longer than that.
+//
+// push() borrows memory, the caller keeps it alive and in place (no vector
+// reallocation) while lua can reach the buffer. create() and Name.new(n)
+// allocate the elements inside the userdata, owned by lua.
+template <typename T>
+class LuaBuffer
+{
+  static_assert(std::is_trivially_copyable<T>::value, "LuaBuffer: elements must be trivially copyable");
+  static_assert(alignof(T) <= alignof(double), "LuaBuffer: type is over-aligned for a userdata");
+
+public:
+  /** Push a writable view of count elements at data */
+  static void push(lua_State *L, T *data, size_t count) { PushView(L, data, count, false); }
+
+  /** Push a read-only view of count elements at data */
+  static void push(lua_State *L, const T *data, size_t count) { PushView(L, const_cast<T *>(data), count, true); }
+
+  static void push(lua_State *L, std::vector<T> &vector) { push(L, vector.data(), vector.size()); }
+  static void push(lua_State *L, const std::vector<T> &vector) { push(L, vector.data(), vector.size()); }
+
+  /** Push a buffer of count zeroed elements owned by lua
+   * @return The elements, valid while lua holds the buffer
+   */
+  static T *create(lua_State *L, size_t count)
+  {
+    if (count > MaxCount())
+      luaL_error(L, "LuaBuffer: %f elements don't fit in memory", static_cast<lua_Number>(count));
+    Header *header = static_cast<Header *>(lua_newuserdata(L, Offset() + count * sizeof(T)));
+    header->data = reinterpret_cast<T *>(reinterpret_cast<char *>(header) + Offset());
+    header->size = count;
+    header->readOnly = false;
+    header->owned = true;
+    std::memset(static_cast<void *>(header->data), 0, count * sizeof(T));
+    SetMetatable(L);
+    if constexpr (!std::is_arithmetic<T>::value)
+    {
+      // element objects share this table as their environment, it holds the buffer
+      lua_createtable(L, 1, 0);
+      lua_pushvalue(L, -2);
+      lua_rawseti(L, -2, 1);
+      lua_setfenv(L, -2);
+    }
+    return header->data;
+  }
+
+  /** Check if the value at index is a LuaBuffer<T> */
+  static bool is(lua_State *L, int index)
+  {
+    if (!lua_touserdata(L, index) || !lua_getmetatable(L, index))
+      return false;
+    Metatable(L);
+    bool same = lua_rawequal(L, -1, -2) != 0;
+    lua_pop(L, 2);
+    return same;
+  }
+
+  /** Get the buffer at index
+   * @return The view, empty if the value is not a LuaBuffer<T>
+   */
+  static LuaBufferView<T> to(lua_State *L, int index)
+  {
+    if (!is(L, index))
+      return LuaBufferView<T>();
+    Header *header = static_cast<Header *>(lua_touserdata(L, index));
+    return LuaBufferView<T>{header->data, header->size, header->readOnly};
+  }
+
+  /** Get the buffer at index, raising a lua error if it is not a LuaBuffer<T> */
+  static LuaBufferView<T> check(lua_State *L, int index)
+  {
+    if (!is(L, index))
+      luaL_typerror(L, index, "LuaBuffer");
+    Header *header = static_cast<Header *>(lua_touserdata(L, index));
+    return LuaBufferView<T>{header->data, header->size, header->readOnly};
+  }
+
+  /** Add a global class table so scripts can allocate buffers with Name.new(n) */
+  static void Register(lua_State *L, const char *name)
+  {
+    lua_newtable(L);
+    lua_pushcfunction(L, &New);
+    lua_setfield(L, -2, "new");
+    lua_setglobal(L, name);
+  }
+
+  /** The registry key of the metatable */
+  static const char *Key()
+  {
+    static const std::string key = std::string("LuaBuffer.") + typeid(T).name();
+    return key.c_str();
+  }
+
+private:
+  struct Header
+  {
+    T *data;
+    size_t size;
+    bool readOnly;
+    bool owned; // the elements follow the header
+  };
+
+  // elements of an owned buffer start after the header
+  static constexpr size_t Offset() { return (sizeof(Header) + alignof(double) - 1) / alignof(double) * alignof(double); }
+
+  // the most elements an owned buffer can have without overflowing its size
+  static constexpr size_t MaxCount() { return (SIZE_MAX - Offset()) / sizeof(T); }
+
+  // checks that the number at index converts to T without overflow
+  static T CheckValue(lua_State *L, int index)
+  {
+    lua_Number n = luaL_checknumber(L, index);
+    if constexpr (std::is_integral<T>::value)
+    {
+      // the range is [min, max + 1) after truncation, both ends are powers of two
+      lua_Number limit = std::ldexp(lua_Number(1), std::numeric_limits<T>::digits);
+      lua_Number lower = std::is_signed<T>::value ? -limit : 0;
+      lua_Number whole = std::trunc(n);
+      if (!(whole >= lower && whole < limit))
+        luaL_error(L, "LuaBuffer: %f is out of range for the element type", n);
+    }
+    else if constexpr (sizeof(T) < sizeof(lua_Number))
+    {
+      if (std::isfinite(n) && std::fabs(n) > static_cast<lua_Number>(std::numeric_limits<T>::max()))
+        luaL_error(L, "LuaBuffer: %f is out of range for the element type", n);
+    }
+    return static_cast<T>(n);
+  }
+
+  static void PushView(lua_State *L, T *data, size_t count, bool readOnly)
+  {
+    Header *header = static_cast<Header *>(lua_newuserdata(L, sizeof(Header)));
+    header->data = data;
+    header->size = count;
+    header->readOnly = readOnly;
+    header->owned = false;
+    SetMetatable(L);
+  }
+
+  // pushes the metatable, creating it on first use
+  static void Metatable(lua_State *L)
+  {
+    if (luaL_newmetatable(L, Key()))
+    {
+      lua_pushcfunction(L, &Index);
+      lua_setfield(L, -2, "__index");
+      lua_pushcfunction(L, &NewIndex);
+      lua_setfield(L, -2, "__newindex");
+      lua_pushcfunction(L, &Length);
+      lua_setfield(L, -2, "__len");
+      lua_pushcfunction(L, &ToString);
+      lua_setfield(L, -2, "__tostring");
+      lua_pushstring(L, "LuaBuffer");
+      lua_setfield(L, -2, "__metatable");
+    }
+  }
+
+  static void SetMetatable(lua_State *L)
+  {
+    Metatable(L);
+    lua_setmetatable(L, -2);
+  }
+
+  // the buffer of a userdata known to carry this metatable
+  static Header &Self(lua_State *L) { return *static_cast<Header *>(lua_touserdata(L, 1)); }
+
+  // 1-based index at 2 to an element offset, raising a lua error outside the buffer
+  static size_t Element(lua_State *L, const Header &header)
+  {
+    if (lua_type(L, 2) != LUA_TNUMBER)
+      luaL_error(L, "LuaBuffer: index must be a number, got %s", luaL_typename(L, 2));
+    lua_Number n = lua_tonumber(L, 2);
+    if (!(n >= 1 && n <= static_cast<lua_Number>(header.size)) || static_cast<lua_Number>(static_cast<size_t>(n)) != n)
+      luaL_error(L, "LuaBuffer: index %f out of range [1, %d]", n, static_cast<int>(header.size));
+    return static_cast<size_t>(n) - 1;
+  }
+
+  static int Index(lua_State *L)
+  {
+    Header &header = Self(L);
+    T &element = header.data[Element(L, header)];
+    if constexpr (std::is_same<T, bool>::value)
+      lua_pushboolean(L, element);
+    else if constexpr (std::is_arithmetic<T>::value)
+      lua_pushnumber(L, static_cast<lua_Number>(element));
+    else if (header.readOnly)
+    {
+      // a borrowed object could be written through its property setters
+      LuaClass<T>::push(L, element);
+    }
+    else
+    {
+      LuaClass<T>::pushPointer(L, &element);
+      if (header.owned)
+      {
+        lua_getfenv(L, 1);
+        lua_setfenv(L, -2);
+      }
+    }
+    return 1;
+  }
+
+  static int NewIndex(lua_State *L)
+  {
+    Header &header = Self(L);
+    if (header.readOnly)
+      return luaL_error(L, "LuaBuffer: buffer is read-only");
+    T &element = header.data[Element(L, header)];
+    if constexpr (std::is_same<T, bool>::value)
+      element = lua_toboolean(L, 3) != 0;
+    else if constexpr (std::is_arithmetic<T>::value)
+      element = CheckValue(L, 3);
+    else
+      element = *LuaClass<T>::check(L, 3);
+    return 0;
+  }
+
+  static int Length(lua_State *L)
+  {
+    lua_pushinteger(L, static_cast<lua_Integer>(Self(L).size));
+    return 1;
+  }
+
+  static int ToString(lua_State *L)
+  {
+    lua_pushfstring(L, "LuaBuffer: %p (%d)", static_cast<void *>(Self(L).data), static_cast<int>(Self(L).size));
+    return 1;
+  }
+
+  // Name.new(n)
+  static int New(lua_State *L)
+  {
+    lua_Integer count = luaL_checkinteger(L, 1);
+    luaL_argcheck(L, count >= 0, 1, "size must not be negative");
+    luaL_argcheck(L, static_cast<uint64_t>(count) <= MaxCount(), 1, "size is too large");
+    create(L, static_cast<size_t>(count));
+    return 1;
+  }
+};
+
+// LuaStack for buffers, bound functions take and return LuaBufferView<T>
+// without copying the elements
+template <typename T>
+struct LuaStack<LuaBufferView<T>>
+{
+  static void push(lua_State *L, const LuaBufferView<T> &view)
+  {
+    if (view.readOnly)
+      LuaBuffer<T>::push(L, static_cast<const T *>(view.data), view.size);
+    else
+      LuaBuffer<T>::push(L, view.data, view.size);
+  }
+  static LuaBufferView<T> get(lua_State *L, int index) { return LuaBuffer<T>::check(L, index); }
+};
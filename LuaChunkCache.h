@@ -0,0 +1,282 @@
+// Copyright (C) 2023 Theros < MisModding | SvalTek >
+//
+// This file is part of LuaBinder.
+//
+// LuaBinder is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LuaBinder is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LuaBinder.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+#include "Lua.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <string_view>
+#include <thread>
+
+// ─── LuaChunkCache ───────────────────────────────────────────────────────────
+
+struct LuaChunkCacheStats
+{
+  size_t hits = 0;     // function reused from the state's registry
+  size_t diskHits = 0; // bytecode loaded from the cache directory
+  size_t misses = 0;   // source compiled
+};
+
+// class LuaChunkCache
+// Compiled chunk cache for LuaScript::runString and runFile, keyed by a hash
+// of the chunk name and source. A compiled function is kept in the registry
+// of the state that loaded it, so every distinct source stays alive for the
+// life of that state. With a directory, the lua_dump output of every
+// compiled chunk is written there and later processes load the bytecode
+// instead of parsing. Bytecode that does not match this build of lua is
+// rejected by the loader and compiled again.
+// The hash only picks the slot: a cached function or file also holds the
+// chunk name and source it was compiled from, and is used only if they match.
+// Lua 5.1 does not verify bytecode, loading a crafted file can run arbitrary
+// code or corrupt memory, so the directory must only be writable by trusted
+// users.
+// One cache may be shared by several states, e.g. all states of a
+// LuaStatePool.
+class LuaChunkCache
+{
+public:
+  /** @param directory where bytecode is persisted, empty keeps the cache in memory */
+  explicit LuaChunkCache(std::string directory = "") : dir(std::move(directory))
+  {
+    if (!dir.empty())
+    {
+      std::error_code ec;
+      std::filesystem::create_directories(dir, ec);
+      if (ec)
+      {
+        LUA_LOG(LUA_LOG_WARN, "LuaChunkCache: can't create (" << dir << ") " << ec.message());
+        dir.clear();
+      }
+    }
+  }
+
+  /** Load a chunk, like luaL_loadbuffer
+   * @param source lua source text
+   * @param chunkname name used in error messages and debug info
+   * @return 0 with the function on the stack, or a lua error code with the message on the stack
+   */
+  int load(lua_State *L, std::string_view source, const char *chunkname)
+  {
+    char key[KeySize];
+    Key(source, chunkname, key);
+
+    // in-process reuse
+    lua_getfield(L, LUA_REGISTRYINDEX, RegistryKey);
+    if (!lua_istable(L, -1))
+    {
+      lua_pop(L, 1);
+      lua_newtable(L);
+      lua_pushvalue(L, -1);
+      lua_setfield(L, LUA_REGISTRYINDEX, RegistryKey);
+    }
+    // registry[RegistryKey][key] = {function, source, chunkname}
+    lua_pushlstring(L, key, KeySize);
+    lua_rawget(L, -2);
+    if (lua_istable(L, -1))
+    {
+      lua_rawgeti(L, -1, 2);
+      lua_rawgeti(L, -2, 3);
+      bool same = Matches(L, -2, source) && Matches(L, -1, chunkname);
+      lua_pop(L, 2);
+      if (same)
+      {
+        lua_rawgeti(L, -1, 1);
+        lua_replace(L, -3);
+        lua_pop(L, 1);
+        counters.hits++;
+        return 0;
+      }
+    }
+    lua_pop(L, 1);
+
+    int status = -1;
+    if (!dir.empty())
+    {
+      std::string file;
+      std::string_view bytecode;
+      if (ReadFile(Path(key), file) && Unpack(file, source, chunkname, bytecode))
+      {
+        status = luaL_loadbuffer(L, bytecode.data(), bytecode.size(), chunkname);
+        if (status == 0)
+          counters.diskHits++;
+        else
+        {
+          LUA_LOG(LUA_LOG_DEBUG, "LuaChunkCache: stale bytecode for " << chunkname << " (" << lua_tostring(L, -1) << ")");
+          lua_pop(L, 1);
+        }
+      }
+    }
+
+    if (status != 0)
+    {
+      counters.misses++;
+      status = luaL_loadbuffer(L, source.data(), source.size(), chunkname);
+      if (status != 0)
+      {
+        lua_remove(L, -2);
+        return status;
+      }
+      if (!dir.empty())
+        Persist(L, key, source, chunkname);
+    }
+
+    lua_pushlstring(L, key, KeySize);
+    lua_createtable(L, 3, 0);
+    lua_pushvalue(L, -3);
+    lua_rawseti(L, -2, 1);
+    lua_pushlstring(L, source.data(), source.size());
+    lua_rawseti(L, -2, 2);
+    lua_pushstring(L, chunkname);
+    lua_rawseti(L, -2, 3);
+    lua_rawset(L, -4);
+    lua_remove(L, -2);
+    return 0;
+  }
+
+  LuaChunkCacheStats stats() const
+  {
+    LuaChunkCacheStats s;
+    s.hits = counters.hits;
+    s.diskHits = counters.diskHits;
+    s.misses = counters.misses;
+    return s;
+  }
+
+  const std::string &directory() const { return dir; }
+
+private:
+  static constexpr const char *RegistryKey = "LuaBinder.LuaChunkCache";
+
+  static constexpr size_t KeySize = 16;
+
+  // FNV-1a over the chunk name and source, as 16 hex digits
+  static void Key(std::string_view source, const char *chunkname, char (&key)[KeySize])
+  {
+    uint64_t hash = 14695981039346656037ull;
+    auto mix = [&hash](const char *p, size_t n) {
+      for (size_t i = 0; i < n; i++)
+      {
+        hash ^= static_cast<unsigned char>(p[i]);
+        hash *= 1099511628211ull;
+      }
+    };
+    mix(chunkname, std::strlen(chunkname) + 1);
+    mix(source.data(), source.size());
+    char hex[17];
+    std::snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(hash));
+    std::memcpy(key, hex, KeySize);
+  }
+
+  static bool Matches(lua_State *L, int index, std::string_view text)
+  {
+    size_t size;
+    const char *stored = lua_tolstring(L, index, &size);
+    return stored && size == text.size() && std::memcmp(stored, text.data(), size) == 0;
+  }
+
+  // A cache file is the magic, the sizes of the chunk name and source, both
+  // texts and then the bytecode. Sizes are in native byte order, like the
+  // bytecode itself.
+  static constexpr char Magic[4] = {'L', 'B', 'C', '1'};
+
+  static std::string Pack(std::string_view bytecode, std::string_view source, std::string_view chunkname)
+  {
+    uint64_t sizes[2] = {chunkname.size(), source.size()};
+    std::string file;
+    file.reserve(sizeof(Magic) + sizeof(sizes) + chunkname.size() + source.size() + bytecode.size());
+    file.append(Magic, sizeof(Magic));
+    file.append(reinterpret_cast<const char *>(sizes), sizeof(sizes));
+    file.append(chunkname);
+    file.append(source);
+    file.append(bytecode);
+    return file;
+  }
+
+  // finds the bytecode in a cache file, false unless it was built from source and chunkname
+  static bool Unpack(std::string_view file, std::string_view source, std::string_view chunkname, std::string_view &bytecode)
+  {
+    uint64_t sizes[2];
+    size_t header = sizeof(Magic) + sizeof(sizes);
+    if (file.size() < header || file.compare(0, sizeof(Magic), std::string_view(Magic, sizeof(Magic))) != 0)
+      return false;
+    std::memcpy(sizes, file.data() + sizeof(Magic), sizeof(sizes));
+    if (sizes[0] != chunkname.size() || sizes[1] != source.size() || file.size() - header < sizes[0] + sizes[1])
+      return false;
+    if (file.compare(header, chunkname.size(), chunkname) != 0 || file.compare(header + chunkname.size(), source.size(), source) != 0)
+      return false;
+    bytecode = file.substr(header + chunkname.size() + source.size());
+    return !bytecode.empty();
+  }
+
+  std::string Path(const char (&key)[KeySize]) const { return dir + "/" + std::string(key, KeySize) + ".luac"; }
+
+  static bool ReadFile(const std::string &path, std::string &out)
+  {
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+      return false;
+    std::ostringstream content;
+    content << file.rdbuf();
+    out = content.str();
+    return !out.empty();
+  }
+
+  static int Writer(lua_State *, const void *p, size_t size, void *ud)
+  {
+    static_cast<std::string *>(ud)->append(static_cast<const char *>(p), size);
+    return 0;
+  }
+
+  // writes the function on top of the stack to the cache directory, through
+  // a temporary file so concurrent processes never see a partial chunk
+  void Persist(lua_State *L, const char (&key)[KeySize], std::string_view source, const char *chunkname)
+  {
+    std::string bytecode;
+    lua_dump(L, &Writer, &bytecode);
+    bytecode = Pack(bytecode, source, chunkname);
+    std::string path = Path(key);
+    size_t unique = std::hash<std::thread::id>()(std::this_thread::get_id()) ^
+                    static_cast<size_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+    std::string tmp = path + "." + std::to_string(unique) + ".tmp";
+    {
+      std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+      if (!file.write(bytecode.data(), bytecode.size()))
+      {
+        LUA_LOG(LUA_LOG_WARN, "LuaChunkCache: can't write (" << tmp << ")");
+        return;
+      }
+    }
+    if (std::rename(tmp.c_str(), path.c_str()) != 0)
+      std::remove(tmp.c_str());
+  }
+
+  struct Counters
+  {
+    std::atomic<size_t> hits{0};
+    std::atomic<size_t> diskHits{0};
+    std::atomic<size_t> misses{0};
+  };
+
+  std::string dir;
+  Counters counters;
+};
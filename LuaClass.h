@@ -0,0 +1,506 @@
+// Copyright (C) 2023 Theros < MisModding | SvalTek >
+//
+// This file is part of LuaBinder.
+//
+// LuaBinder is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LuaBinder is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LuaBinder.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+#include "LuaScript.h"
+#include <functional>
+#include <string>
+#include <type_traits>
+#include <typeinfo>
+#include <utility>
+
+// ─── LuaMethodTraits ─────────────────────────────────────────────────────────
+
+template <typename... Types>
+struct LuaTypeList
+{
+};
+
+// LuaMethodTraits
+// Signature is LuaTypeList<Ret, Args...> without the object parameter, for
+// member functions and for free functions taking the object as `T&` first
+template <typename M>
+struct LuaMethodTraits;
+
+template <typename C, typename R, typename... A>
+struct LuaMethodTraits<R (C::*)(A...)>
+{
+  using Signature = LuaTypeList<R, A...>;
+};
+
+template <typename C, typename R, typename... A>
+struct LuaMethodTraits<R (C::*)(A...) const>
+{
+  using Signature = LuaTypeList<R, A...>;
+};
+
+template <typename C, typename R, typename... A>
+struct LuaMethodTraits<R (C::*)(A...) noexcept>
+{
+  using Signature = LuaTypeList<R, A...>;
+};
+
+template <typename C, typename R, typename... A>
+struct LuaMethodTraits<R (C::*)(A...) const noexcept>
+{
+  using Signature = LuaTypeList<R, A...>;
+};
+
+template <typename S, typename R, typename... A>
+struct LuaMethodTraits<R (*)(S, A...)>
+{
+  using Signature = LuaTypeList<R, A...>;
+};
+
+// LuaMemberType
+// the type of a data member pointer
+template <typename M>
+struct LuaMemberType;
+
+template <typename C, typename U>
+struct LuaMemberType<U C::*>
+{
+  using type = U;
+};
+
+// ─── LuaClass ────────────────────────────────────────────────────────────────
+
+// class LuaClass
+// Binds a C++ type as a full userdata with one metatable per type and state.
+//
+//   LuaClass<Entity>(L, "Entity")
+//       .constructor<int, std::string>()
+//       .method<&Entity::move>("move")
+//       .property<&Entity::health>("health")
+//       .property<&Entity::getName, &Entity::setName>("name");
+//
+//   local e = Entity.new(1, "player")
+//   e:move(2, 3)
+//   e.health = e.health - 10
+//
+// Objects made by constructors or push() live inline in the userdata and
+// are destroyed by __gc. pushPointer() hands lua a borrowed object, which
+// the caller keeps alive while lua can reach it.
+// Every method, getter and setter is a lua_CFunction generated for that
+// member, there is no std::function on the call path. Methods check `self`
+// against the metatable held in their first upvalue.
+// Use LUA_CLASS_STACK(T) to pass T, T& and T* through bound functions.
+template <typename T>
+class LuaClass
+{
+  static_assert(alignof(T) <= alignof(double), "LuaClass: type is over-aligned for a userdata");
+
+public:
+  /** Create the metatable for T, or reopen it to add members
+   * @param L lua_State to register in
+   * @param name global name of the class table
+   */
+  LuaClass(lua_State *L, const char *name) : L(L), name(name)
+  {
+    if (luaL_newmetatable(L, Key()))
+    {
+      lua_newtable(L); // methods
+      lua_pushvalue(L, -1);
+      lua_setfield(L, -3, ".methods");
+      lua_newtable(L); // getters
+      lua_pushvalue(L, -1);
+      lua_setfield(L, -4, ".get");
+      lua_pushstring(L, name);
+      lua_pushcclosure(L, &Index, 3);
+      lua_setfield(L, -2, "__index");
+
+      lua_newtable(L); // setters
+      lua_pushvalue(L, -1);
+      lua_setfield(L, -3, ".set");
+      lua_pushstring(L, name);
+      lua_pushcclosure(L, &NewIndex, 2);
+      lua_setfield(L, -2, "__newindex");
+
+      if constexpr (!std::is_trivially_destructible<T>::value)
+      {
+        lua_pushcfunction(L, &Collect);
+        lua_setfield(L, -2, "__gc");
+      }
+      lua_pushstring(L, name);
+      lua_pushcclosure(L, &ToString, 1);
+      lua_setfield(L, -2, "__tostring");
+      lua_pushcfunction(L, &Equal);
+      lua_setfield(L, -2, "__eq");
+      lua_pushstring(L, name);
+      lua_setfield(L, -2, "__metatable");
+
+      // class table: Name.new(...)
+      lua_newtable(L);
+      lua_newtable(L); // constructors by arity
+      lua_pushvalue(L, -1);
+      lua_setfield(L, -4, ".ctors");
+      lua_pushstring(L, name);
+      lua_pushcclosure(L, &New, 2);
+      lua_setfield(L, -2, "new");
+      lua_setglobal(L, name);
+    }
+    lua_pop(L, 1);
+  }
+
+  /** Add a constructor, Name.new picks the constructor by argument count */
+  template <typename... Args>
+  LuaClass &constructor()
+  {
+    lua_pushcfunction(L, &Construct<Args...>);
+    SetMember(".ctors", static_cast<int>(sizeof...(Args)));
+    return *this;
+  }
+
+  /** Add a method
+   * @param name method name, called as obj:name(...)
+   * Method is a member function or a free function taking T& first
+   */
+  template <auto Method>
+  LuaClass &method(const char *methodName)
+  {
+    luaL_getmetatable(L, Key());
+    lua_getfield(L, -1, ".methods");
+    lua_pushvalue(L, -2);
+    lua_pushfstring(L, "%s:%s", name, methodName);
+    lua_pushcclosure(L, &MethodCall<Method>, 2);
+    lua_setfield(L, -2, methodName);
+    lua_pop(L, 2);
+    return *this;
+  }
+
+  /** Add a property backed by a data member, or a read-only property backed by a getter
+   * const data members are read-only
+   */
+  template <auto Member>
+  LuaClass &property(const char *propertyName)
+  {
+    if constexpr (std::is_member_object_pointer<decltype(Member)>::value)
+    {
+      using U = typename LuaMemberType<decltype(Member)>::type;
+      lua_pushcfunction(L, &FieldGet<Member>);
+      SetMember(".get", propertyName);
+      if constexpr (!std::is_const<U>::value)
+      {
+        lua_pushcfunction(L, &FieldSet<Member>);
+        SetMember(".set", propertyName);
+      }
+    }
+    else
+    {
+      lua_pushcfunction(L, &GetterCall<Member>);
+      SetMember(".get", propertyName);
+    }
+    return *this;
+  }
+
+  /** Add a property backed by a getter and a setter */
+  template <auto Getter, auto Setter>
+  LuaClass &property(const char *propertyName)
+  {
+    property<Getter>(propertyName);
+    lua_pushcfunction(L, &SetterCall<Setter>);
+    SetMember(".set", propertyName);
+    return *this;
+  }
+
+  /** Push a copy of value, owned by lua */
+  static void push(lua_State *L, const T &value) { emplace(L, value); }
+  static void push(lua_State *L, T &&value) { emplace(L, std::move(value)); }
+
+  /** Construct a T inside a new userdata on the stack
+   * @return The new object
+   */
+  template <typename... Args>
+  static T *emplace(lua_State *L, Args &&...args)
+  {
+    InlineBox *box = static_cast<InlineBox *>(lua_newuserdata(L, sizeof(InlineBox)));
+    box->object = nullptr;
+    box->object = new (&box->storage) T(std::forward<Args>(args)...);
+    luaL_getmetatable(L, Key());
+    lua_setmetatable(L, -2);
+    return box->object;
+  }
+
+  /** Push a borrowed object, lua never destroys it
+   * nil is pushed for nullptr
+   */
+  static void pushPointer(lua_State *L, T *object)
+  {
+    if (!object)
+    {
+      lua_pushnil(L);
+      return;
+    }
+    Box *box = static_cast<Box *>(lua_newuserdata(L, sizeof(Box)));
+    box->object = object;
+    luaL_getmetatable(L, Key());
+    lua_setmetatable(L, -2);
+  }
+
+  /** Get the object at index
+   * @return The object, or nullptr if the value is not a T
+   */
+  static T *to(lua_State *L, int index)
+  {
+    Box *box = static_cast<Box *>(lua_touserdata(L, index));
+    if (!box || !lua_getmetatable(L, index))
+      return nullptr;
+    luaL_getmetatable(L, Key());
+    bool same = lua_rawequal(L, -1, -2) != 0;
+    lua_pop(L, 2);
+    return same ? box->object : nullptr;
+  }
+
+  /** Get the object at index, raising a lua error if it is not a T */
+  static T *check(lua_State *L, int index)
+  {
+    if (T *object = to(L, index))
+      return object;
+    luaL_typerror(L, index, typeid(T).name());
+    return nullptr;
+  }
+
+  /** The registry key of the metatable */
+  static const char *Key() { return typeid(T).name(); }
+
+private:
+  struct Box
+  {
+    T *object;
+  };
+
+  struct InlineBox
+  {
+    T *object;
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+  };
+
+  // metatable[table][key] = value on top of the stack
+  template <typename K>
+  void SetMember(const char *table, K key)
+  {
+    luaL_getmetatable(L, Key());
+    lua_getfield(L, -1, table);
+    if constexpr (std::is_integral<K>::value)
+    {
+      lua_pushvalue(L, -3);
+      lua_rawseti(L, -2, key);
+    }
+    else
+    {
+      lua_pushstring(L, key);
+      lua_pushvalue(L, -4);
+      lua_rawset(L, -3);
+    }
+    lua_pop(L, 3);
+  }
+
+  // the object of a userdata known to carry this metatable
+  static T &Self(lua_State *L, int index) { return *static_cast<Box *>(lua_touserdata(L, index))->object; }
+
+  // Index
+  // __index, upvalues: methods, getters, class name
+  static int Index(lua_State *L)
+  {
+    lua_pushvalue(L, 2);
+    lua_rawget(L, lua_upvalueindex(1));
+    if (!lua_isnil(L, -1))
+      return 1;
+    lua_pop(L, 1);
+    lua_pushvalue(L, 2);
+    lua_rawget(L, lua_upvalueindex(2));
+    lua_CFunction getter = lua_tocfunction(L, -1);
+    if (!getter)
+      return 0;
+    lua_settop(L, 1);
+    return getter(L);
+  }
+
+  // NewIndex
+  // __newindex, upvalues: setters, class name
+  static int NewIndex(lua_State *L)
+  {
+    lua_pushvalue(L, 2);
+    lua_rawget(L, lua_upvalueindex(1));
+    lua_CFunction setter = lua_tocfunction(L, -1);
+    if (!setter)
+      return luaL_error(L, "%s: no writable property '%s'", lua_tostring(L, lua_upvalueindex(2)), lua_tostring(L, 2));
+    lua_settop(L, 3);
+    return setter(L);
+  }
+
+  // New
+  // Name.new(...), upvalues: constructors, class name
+  static int New(lua_State *L)
+  {
+    lua_rawgeti(L, lua_upvalueindex(1), lua_gettop(L));
+    lua_CFunction construct = lua_tocfunction(L, -1);
+    if (!construct)
+      return luaL_error(L, "%s.new: no constructor taking %d arguments", lua_tostring(L, lua_upvalueindex(2)), lua_gettop(L) - 1);
+    lua_pop(L, 1);
+    return construct(L);
+  }
+
+  template <typename... Args>
+  static int Construct(lua_State *L)
+  {
+    return ConstructWith<Args...>(L, std::index_sequence_for<Args...>{});
+  }
+
+  template <typename... Args, std::size_t... I>
+  static int ConstructWith(lua_State *L, std::index_sequence<I...>)
+  {
+    emplace(L, LuaStack<LuaArg<Args>>::get(L, static_cast<int>(I) + 1)...);
+    return 1;
+  }
+
+  // MethodCall
+  // upvalues: metatable, "Class:method"
+  template <auto Method>
+  static int MethodCall(lua_State *L)
+  {
+    return Dispatch<Method>(L, typename LuaMethodTraits<decltype(Method)>::Signature{});
+  }
+
+  template <auto Method, typename Ret, typename... Args>
+  static int Dispatch(lua_State *L, LuaTypeList<Ret, Args...>)
+  {
+    if (lua_gettop(L) != static_cast<int>(sizeof...(Args)) + 1)
+      return luaL_error(L, "%s: invalid number of arguments, expected %d, got %d",
+                        lua_tostring(L, lua_upvalueindex(2)), static_cast<int>(sizeof...(Args)), lua_gettop(L) - 1);
+    if (!lua_getmetatable(L, 1) || !lua_rawequal(L, -1, lua_upvalueindex(1)))
+      return luaL_error(L, "%s: self is not a %s (use ':' to call methods)", lua_tostring(L, lua_upvalueindex(2)), Key());
+    lua_pop(L, 1);
+    return Invoke<Method, Ret, Args...>(L, Self(L, 1), std::index_sequence_for<Args...>{});
+  }
+
+  template <auto Method, typename Ret, typename... Args, std::size_t... I>
+  static int Invoke(lua_State *L, T &self, std::index_sequence<I...>)
+  {
+    if constexpr (std::is_void<Ret>::value)
+    {
+      std::invoke(Method, self, LuaStack<LuaArg<Args>>::get(L, static_cast<int>(I) + 2)...);
+      return 0;
+    }
+    else
+    {
+      return LuaReturn<LuaArg<Ret>>::push(L, std::invoke(Method, self, LuaStack<LuaArg<Args>>::get(L, static_cast<int>(I) + 2)...));
+    }
+  }
+
+  // property accessors, called from Index / NewIndex with self at 1 and the value at 3
+  template <auto Member>
+  static int FieldGet(lua_State *L)
+  {
+    using U = typename LuaMemberType<decltype(Member)>::type;
+    LuaStack<LuaArg<U>>::push(L, Self(L, 1).*Member);
+    return 1;
+  }
+
+  template <auto Member>
+  static int FieldSet(lua_State *L)
+  {
+    using U = typename LuaMemberType<decltype(Member)>::type;
+    Self(L, 1).*Member = LuaStack<LuaArg<U>>::get(L, 3);
+    return 0;
+  }
+
+  template <auto Getter>
+  static int GetterCall(lua_State *L)
+  {
+    using Ret = decltype(std::invoke(Getter, Self(L, 1)));
+    LuaStack<LuaArg<Ret>>::push(L, std::invoke(Getter, Self(L, 1)));
+    return 1;
+  }
+
+  template <auto Setter>
+  static int SetterCall(lua_State *L)
+  {
+    return SetWith<Setter>(L, typename LuaMethodTraits<decltype(Setter)>::Signature{});
+  }
+
+  template <auto Setter, typename Ret, typename Value>
+  static int SetWith(lua_State *L, LuaTypeList<Ret, Value>)
+  {
+    std::invoke(Setter, Self(L, 1), LuaStack<LuaArg<Value>>::get(L, 3));
+    return 0;
+  }
+
+  // Collect
+  // __gc, only objects stored inline are destroyed
+  static int Collect(lua_State *L)
+  {
+    if (lua_objlen(L, 1) == sizeof(InlineBox))
+    {
+      InlineBox *box = static_cast<InlineBox *>(lua_touserdata(L, 1));
+      if (box->object)
+        box->object->~T();
+    }
+    return 0;
+  }
+
+  static int ToString(lua_State *L)
+  {
+    lua_pushfstring(L, "%s: %p", lua_tostring(L, lua_upvalueindex(1)), static_cast<void *>(&Self(L, 1)));
+    return 1;
+  }
+
+  static int Equal(lua_State *L)
+  {
+    lua_pushboolean(L, to(L, 1) == to(L, 2));
+    return 1;
+  }
+
+  lua_State *L;
+  const char *name;
+};
+
+// ─── LuaStack for bound classes ──────────────────────────────────────────────
+
+// LuaClassStack
+// values are copied into lua, get returns a reference to the object in lua
+template <typename T>
+struct LuaClassStack
+{
+  static void push(lua_State *L, const T &value) { LuaClass<T>::push(L, value); }
+  static T &get(lua_State *L, int index) { return *LuaClass<T>::check(L, index); }
+};
+
+// LuaClassPointerStack
+// pointers are pushed borrowed, nil reads as nullptr
+template <typename T>
+struct LuaClassPointerStack
+{
+  static void push(lua_State *L, T *object) { LuaClass<typename std::remove_const<T>::type>::pushPointer(L, const_cast<typename std::remove_const<T>::type *>(object)); }
+  static T *get(lua_State *L, int index) { return lua_isnil(L, index) ? nullptr : LuaClass<typename std::remove_const<T>::type>::check(L, index); }
+};
+
+// LUA_CLASS_STACK
+// lets T, T&, const T&, T* and const T* cross bound functions, e.g. after
+// `LUA_CLASS_STACK(Entity)` a LuaFunction<void(Entity &)> takes an Entity
+#define LUA_CLASS_STACK(T)                                         \
+  template <>                                                      \
+  struct LuaStack<T> : LuaClassStack<T>                            \
+  {                                                                \
+  };                                                               \
+  template <>                                                      \
+  struct LuaStack<T *> : LuaClassPointerStack<T>                   \
+  {                                                                \
+  };                                                               \
+  template <>                                                      \
+  struct LuaStack<const T *> : LuaClassPointerStack<const T>       \
+  {                                                                \
+  }
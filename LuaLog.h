@@ -0,0 +1,202 @@
+// Copyright (C) 2023 Theros < MisModding | SvalTek >
+//
+// This file is part of LuaBinder.
+//
+// LuaBinder is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LuaBinder is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LuaBinder.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// ─── Log levels ──────────────────────────────────────────────────────────────
+
+#define LUA_LOG_TRACE 0
+#define LUA_LOG_DEBUG 1
+#define LUA_LOG_INFO 2
+#define LUA_LOG_WARN 3
+#define LUA_LOG_ERROR 4
+#define LUA_LOG_OFF 5
+
+// LUABINDER_LOG_LEVEL
+// messages below this level are compiled out, define it before including
+// LuaBinder to change it. Trace covers per call detail such as stack dumps.
+#ifndef LUABINDER_LOG_LEVEL
+#ifdef NDEBUG
+#define LUABINDER_LOG_LEVEL LUA_LOG_WARN
+#else
+#define LUABINDER_LOG_LEVEL LUA_LOG_DEBUG
+#endif
+#endif
+
+// LUA_LOG
+// LUA_LOG(LUA_LOG_ERROR, "can't get [" << name << "]")
+// the message is a stream expression, it is neither compiled in below
+// LUABINDER_LOG_LEVEL nor evaluated below the runtime level
+#define LUA_LOG(level, message)                                    \
+  do                                                               \
+  {                                                                \
+    if constexpr ((level) >= LUABINDER_LOG_LEVEL)                  \
+    {                                                              \
+      if (LuaLog::enabled(level))                                  \
+      {                                                            \
+        std::ostringstream luaLogStream_;                          \
+        luaLogStream_ << message;                                  \
+        LuaLog::write(level, luaLogStream_.str());                 \
+      }                                                            \
+    }                                                              \
+  } while (0)
+
+// ─── LuaLog ──────────────────────────────────────────────────────────────────
+
+// LuaLogSink
+// receives every message that passes both level checks
+using LuaLogSink = std::function<void(int level, std::string_view message)>;
+
+class LuaLog
+{
+public:
+  /** Replace the sink, an empty sink drops everything
+   * @param sink the new sink
+   */
+  static void setSink(LuaLogSink sink)
+  {
+    std::lock_guard<std::mutex> lock(mutex());
+    currentSink() = std::move(sink);
+  }
+
+  /** Set the runtime level
+   * levels below LUABINDER_LOG_LEVEL stay compiled out whatever this is set to
+   * @param level lowest level that is written
+   */
+  static void setLevel(int level) { runtimeLevel() = level; }
+
+  static int level() { return runtimeLevel(); }
+
+  static bool enabled(int level) { return level >= runtimeLevel(); }
+
+  static void write(int level, std::string_view message)
+  {
+    std::lock_guard<std::mutex> lock(mutex());
+    if (currentSink())
+      currentSink()(level, message);
+  }
+
+  static const char *levelName(int level)
+  {
+    static const char *names[] = {"trace", "debug", "info", "warn", "error"};
+    return level >= LUA_LOG_TRACE && level < LUA_LOG_OFF ? names[level] : "off";
+  }
+
+  /** Sink writing "[level] message" lines to std::cerr */
+  static LuaLogSink consoleSink()
+  {
+    return [](int level, std::string_view message) {
+      std::cerr << "[" << levelName(level) << "] " << message << std::endl;
+    };
+  }
+
+  /** Sink appending "[level] message" lines to a file
+   * @param filename file to append to
+   */
+  static LuaLogSink fileSink(const std::string &filename)
+  {
+    auto file = std::make_shared<std::ofstream>(filename, std::ios::app);
+    return [file](int level, std::string_view message) {
+      *file << "[" << levelName(level) << "] " << message << '\n';
+      file->flush();
+    };
+  }
+
+private:
+  static std::mutex &mutex()
+  {
+    static std::mutex m;
+    return m;
+  }
+
+  static LuaLogSink &currentSink()
+  {
+    static LuaLogSink sink = consoleSink();
+    return sink;
+  }
+
+  static std::atomic<int> &runtimeLevel()
+  {
+    static std::atomic<int> level{LUABINDER_LOG_LEVEL};
+    return level;
+  }
+};
+
+// class LuaLogRingBuffer
+// Keeps the last `capacity` messages in memory, for hosts that want to
+// pull diagnostics on demand instead of writing them anywhere.
+// The buffer must outlive the sink returned by sink().
+class LuaLogRingBuffer
+{
+public:
+  explicit LuaLogRingBuffer(size_t capacity) : entries(capacity ? capacity : 1) {}
+
+  LuaLogSink sink()
+  {
+    return [this](int level, std::string_view message) { push(level, message); };
+  }
+
+  void push(int level, std::string_view message)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    Entry &e = entries[next % entries.size()];
+    e.level = level;
+    e.message.assign(message.data(), message.size());
+    next++;
+  }
+
+  /** Get the retained messages, oldest first */
+  std::vector<std::pair<int, std::string>> snapshot() const
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<std::pair<int, std::string>> out;
+    size_t count = next < entries.size() ? next : entries.size();
+    out.reserve(count);
+    for (size_t i = next - count; i < next; i++)
+      out.emplace_back(entries[i % entries.size()].level, entries[i % entries.size()].message);
+    return out;
+  }
+
+  /** Get the number of messages received, including overwritten ones */
+  size_t total() const
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return next;
+  }
+
+private:
+  struct Entry
+  {
+    int level = LUA_LOG_OFF;
+    std::string message;
+  };
+
+  mutable std::mutex mutex;
+  std::vector<Entry> entries;
+  size_t next = 0;
+};
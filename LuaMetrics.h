@@ -0,0 +1,248 @@
+// Copyright (C) 2023 Theros < MisModding | SvalTek >
+//
+// This file is part of LuaBinder.
+//
+// LuaBinder is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LuaBinder is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LuaBinder.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+#include "Lua.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// ─── LuaMetrics ──────────────────────────────────────────────────────────────
+
+// struct LuaBindingStats
+// a copy of the counters of one binding
+struct LuaBindingStats
+{
+  // bucket i counts calls taking [2^i, 2^(i+1)) ns, the last bucket is open ended
+  static constexpr size_t Buckets = 32;
+
+  std::string name;
+  uint64_t calls = 0;       // calls that passed the arity check
+  uint64_t errors = 0;      // bad arity plus calls that raised a lua error
+  std::chrono::nanoseconds time{0}; // summed over returned calls
+  std::array<uint64_t, Buckets> histogram{};
+
+  /** Get the latency at a percentile from the histogram
+   * @param p percentile in [0, 1]
+   * @return upper bound of the bucket holding the percentile, 0 without calls
+   */
+  std::chrono::nanoseconds percentile(double p) const
+  {
+    uint64_t total = 0;
+    for (uint64_t count : histogram)
+      total += count;
+    if (total == 0)
+      return std::chrono::nanoseconds(0);
+    uint64_t rank = static_cast<uint64_t>(p * static_cast<double>(total - 1)) + 1;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < Buckets; i++)
+    {
+      seen += histogram[i];
+      if (seen >= rank)
+        return std::chrono::nanoseconds(int64_t(2) << i);
+    }
+    return std::chrono::nanoseconds(int64_t(2) << (Buckets - 1));
+  }
+};
+
+// struct LuaBindingMetrics
+// Live counters of one binding, updated with relaxed atomics so any thread
+// may read them while scripts run. A binding whose lua error longjmps out of
+// the call never returns to count itself, so errors are derived as calls
+// minus returns and include calls still running at snapshot time.
+struct LuaBindingMetrics
+{
+  std::string name;
+  std::atomic<uint64_t> calls{0};
+  std::atomic<uint64_t> returns{0};
+  std::atomic<uint64_t> arityErrors{0};
+  std::atomic<uint64_t> nanoseconds{0};
+  std::array<std::atomic<uint64_t>, LuaBindingStats::Buckets> histogram{};
+
+  explicit LuaBindingMetrics(std::string name) : name(std::move(name)) {}
+
+  void record(uint64_t ns)
+  {
+    returns.fetch_add(1, std::memory_order_relaxed);
+    nanoseconds.fetch_add(ns, std::memory_order_relaxed);
+    size_t bucket = 0;
+    while (ns > 1 && bucket < LuaBindingStats::Buckets - 1)
+    {
+      ns >>= 1;
+      bucket++;
+    }
+    histogram[bucket].fetch_add(1, std::memory_order_relaxed);
+  }
+
+  LuaBindingStats stats() const
+  {
+    LuaBindingStats s;
+    s.name = name;
+    s.calls = calls.load(std::memory_order_relaxed);
+    uint64_t returned = returns.load(std::memory_order_relaxed);
+    s.errors = arityErrors.load(std::memory_order_relaxed) + (s.calls > returned ? s.calls - returned : 0);
+    s.time = std::chrono::nanoseconds(nanoseconds.load(std::memory_order_relaxed));
+    for (size_t i = 0; i < LuaBindingStats::Buckets; i++)
+      s.histogram[i] = histogram[i].load(std::memory_order_relaxed);
+    return s;
+  }
+
+  void reset()
+  {
+    calls.store(0, std::memory_order_relaxed);
+    returns.store(0, std::memory_order_relaxed);
+    arityErrors.store(0, std::memory_order_relaxed);
+    nanoseconds.store(0, std::memory_order_relaxed);
+    for (auto &bucket : histogram)
+      bucket.store(0, std::memory_order_relaxed);
+  }
+
+  // Scope
+  // counts and times one call, a null metrics does nothing
+  class Scope
+  {
+  public:
+    explicit Scope(LuaBindingMetrics *metrics) : metrics(metrics)
+    {
+      if (!metrics)
+        return;
+      metrics->calls.fetch_add(1, std::memory_order_relaxed);
+      exceptions = std::uncaught_exceptions();
+      start = std::chrono::steady_clock::now();
+    }
+    ~Scope()
+    {
+      // lua built as C++ unwinds errors with an exception
+      if (metrics && std::uncaught_exceptions() == exceptions)
+        metrics->record(static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count()));
+    }
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+
+  private:
+    LuaBindingMetrics *metrics;
+    int exceptions = 0;
+    std::chrono::steady_clock::time_point start;
+  };
+};
+
+// class LuaMetrics
+// Call metrics for the LuaFunction bindings of one or more states. Attach it
+// to a state before registering functions, every binding registered while
+// attached counts its calls into the entry for its name. Sharing one
+// LuaMetrics between states (e.g. all states of a LuaStatePool) sums them.
+//
+//   auto metrics = std::make_shared<LuaMetrics>();
+//   script.setMetrics(metrics);
+//   LuaFunction<int(int, int)>::Register<&add>(script.State(), "add");
+//   ...
+//   for (const LuaBindingStats &s : metrics->snapshot())
+//     std::cout << s.name << " " << s.calls << " p99 " << s.percentile(0.99).count() << "ns\n";
+//
+// The LuaMetrics must outlive the states it is attached to.
+class LuaMetrics
+{
+public:
+  LuaMetrics() = default;
+  LuaMetrics(const LuaMetrics &) = delete;
+  LuaMetrics &operator=(const LuaMetrics &) = delete;
+
+  /** Count the bindings registered on L from now on */
+  void attach(lua_State *L)
+  {
+    lua_pushlightuserdata(L, this);
+    lua_setfield(L, LUA_REGISTRYINDEX, RegistryKey);
+  }
+
+  /** Stop counting bindings registered on L from now on */
+  static void detach(lua_State *L)
+  {
+    lua_pushnil(L);
+    lua_setfield(L, LUA_REGISTRYINDEX, RegistryKey);
+  }
+
+  /** Get the metrics attached to L, nullptr if none */
+  static LuaMetrics *of(lua_State *L)
+  {
+    lua_getfield(L, LUA_REGISTRYINDEX, RegistryKey);
+    LuaMetrics *metrics = static_cast<LuaMetrics *>(lua_touserdata(L, -1));
+    lua_pop(L, 1);
+    return metrics;
+  }
+
+  /** Get the counters of a binding, created on first use
+   * @return The counters, valid as long as this LuaMetrics
+   */
+  LuaBindingMetrics *binding(const std::string &name)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto &entry = entries[name];
+    if (!entry)
+      entry = std::make_unique<LuaBindingMetrics>(name);
+    return entry.get();
+  }
+
+  /** Copy the counters of every binding, sorted by name
+   * @param reset zero the counters after copying them
+   */
+  std::vector<LuaBindingStats> snapshot(bool reset = false)
+  {
+    std::vector<LuaBindingStats> stats;
+    std::lock_guard<std::mutex> lock(mutex);
+    stats.reserve(entries.size());
+    for (auto &entry : entries)
+    {
+      stats.push_back(entry.second->stats());
+      if (reset)
+        entry.second->reset();
+    }
+    std::sort(stats.begin(), stats.end(), [](const LuaBindingStats &a, const LuaBindingStats &b) { return a.name < b.name; });
+    return stats;
+  }
+
+  /** Zero the counters of every binding */
+  void reset()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto &entry : entries)
+      entry.second->reset();
+  }
+
+  /** Push the counters for a binding being registered on L as a closure upvalue
+   * pushes nil when no LuaMetrics is attached to L
+   */
+  static void PushUpvalue(lua_State *L, const char *name)
+  {
+    if (LuaMetrics *metrics = of(L))
+      lua_pushlightuserdata(L, metrics->binding(name));
+    else
+      lua_pushnil(L);
+  }
+
+private:
+  static constexpr const char *RegistryKey = "LuaBinder.LuaMetrics";
+
+  std::mutex mutex;
+  std::unordered_map<std::string, std::unique_ptr<LuaBindingMetrics>> entries;
+};
@@ -0,0 +1,356 @@
+// Copyright (C) 2023 Theros < MisModding | SvalTek >
+//
+// This file is part of LuaBinder.
+//
+// LuaBinder is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LuaBinder is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LuaBinder.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+#include "Lua.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// ─── LuaProfiler ─────────────────────────────────────────────────────────────
+
+// struct LuaProfileEntry
+// time attributed to one call stack
+struct LuaProfileEntry
+{
+  size_t samples = 0;                               // hook samples or binding calls
+  std::chrono::steady_clock::duration time{0};
+};
+
+// class LuaProfiler
+// Sampling profiler for one lua_State. A count hook samples the running lua
+// stack every `interval` instructions and charges the time since the previous
+// sample to it, the leaf frame is the current source line. Calls into
+// LuaFunction bindings are timed separately and charged to the calling lua
+// stack plus a "[C] name" frame, so marshalling and native work show up next
+// to script logic instead of inside it.
+//
+//   LuaProfiler profiler(L);
+//   profiler.start();
+//   script.runFile("game.lua");
+//   profiler.stop();
+//   std::ofstream out("game.folded");
+//   profiler.writeCollapsed(out); // flamegraph.pl game.folded > game.svg
+//
+// One profiler per state is active at a time. An existing count hook (a
+// LuaBudget) keeps running: the profiler samples at its interval and calls it
+// after every sample.
+class LuaProfiler
+{
+public:
+  using Clock = std::chrono::steady_clock;
+
+  explicit LuaProfiler(lua_State *L) : L(L) {}
+  ~LuaProfiler() { stop(); }
+
+  LuaProfiler(const LuaProfiler &) = delete;
+  LuaProfiler &operator=(const LuaProfiler &) = delete;
+
+  /** Start sampling, samples of an earlier run are kept
+   * @param interval vm instructions between samples, 0 keeps the last interval (default 1000)
+   */
+  void start(int interval = 0)
+  {
+    if (running)
+      return;
+    lua_getfield(L, LUA_REGISTRYINDEX, RegistryKey);
+    LuaProfiler *other = static_cast<LuaProfiler *>(lua_touserdata(L, -1));
+    lua_pop(L, 1);
+    if (other)
+      other->stop();
+
+    lua_pushlightuserdata(L, this);
+    lua_setfield(L, LUA_REGISTRYINDEX, RegistryKey);
+    prevHook = lua_gethook(L);
+    prevMask = lua_gethookmask(L);
+    prevCount = lua_gethookcount(L);
+    if (interval > 0)
+      sampleInterval = interval;
+    int count = prevHook && (prevMask & LUA_MASKCOUNT) ? prevCount : sampleInterval;
+    lua_sethook(L, &Hook, prevMask | LUA_MASKCOUNT, count);
+    last = Clock::now();
+    excluded = Clock::duration::zero();
+    running = true;
+    Active().fetch_add(1, std::memory_order_relaxed);
+  }
+
+  /** Stop sampling and put back the hook that was set before start */
+  void stop()
+  {
+    if (!running)
+      return;
+    running = false;
+    Active().fetch_sub(1, std::memory_order_relaxed);
+    lua_sethook(L, prevHook, prevMask, prevCount);
+    lua_pushnil(L);
+    lua_setfield(L, LUA_REGISTRYINDEX, RegistryKey);
+    open.clear();
+  }
+
+  bool isRunning() const { return running; }
+
+  /** Drop all samples */
+  void reset()
+  {
+    known.clear();
+    stacks.clear();
+    bindingTotals.clear();
+  }
+
+  /** Get the samples, keyed by collapsed stack ("outer;inner;leaf") */
+  const std::unordered_map<std::string, LuaProfileEntry> &entries() const { return stacks; }
+
+  /** Get the calls and time of every binding, summed over all stacks */
+  const std::unordered_map<std::string, LuaProfileEntry> &bindings() const { return bindingTotals; }
+
+  /** Write the samples as collapsed stacks for flamegraph.pl or speedscope
+   * one line per stack, "frame;frame;frame value", sorted by stack
+   * @param out stream to write to
+   * @param microseconds write time in microseconds, false writes sample counts
+   */
+  void writeCollapsed(std::ostream &out, bool microseconds = true) const
+  {
+    std::map<std::string, const LuaProfileEntry *> sorted;
+    for (const auto &entry : stacks)
+      sorted.emplace(entry.first, &entry.second);
+    for (const auto &entry : sorted)
+    {
+      long long value = microseconds ? std::chrono::duration_cast<std::chrono::microseconds>(entry.second->time).count()
+                                     : static_cast<long long>(entry.second->samples);
+      if (value > 0)
+        out << entry.first << ' ' << value << '\n';
+    }
+  }
+
+  /** Mark the start of a call from the host into lua on L
+   * host time since the last sample is not charged to the script
+   */
+  static void Mark(lua_State *L)
+  {
+    if (Active().load(std::memory_order_relaxed) == 0)
+      return;
+    if (LuaProfiler *profiler = Of(L))
+    {
+      profiler->last = Clock::now();
+      profiler->excluded = Clock::duration::zero();
+    }
+  }
+
+  // BindingScope
+  // times one call of a LuaFunction binding, does nothing unless a profiler
+  // is running somewhere in the process
+  class BindingScope
+  {
+  public:
+    BindingScope(lua_State *L, int nameIndex)
+    {
+      if (Active().load(std::memory_order_relaxed) == 0)
+        return;
+      profiler = Of(L);
+      if (profiler)
+        profiler->Enter(this, L, lua_tostring(L, nameIndex));
+    }
+    ~BindingScope()
+    {
+      if (profiler)
+        profiler->Leave(this);
+    }
+    BindingScope(const BindingScope &) = delete;
+    BindingScope &operator=(const BindingScope &) = delete;
+
+  private:
+    LuaProfiler *profiler = nullptr;
+  };
+
+private:
+  static constexpr const char *RegistryKey = "LuaBinder.LuaProfiler";
+
+  // number of running profilers, keeps BindingScope to one relaxed load otherwise
+  static std::atomic<int> &Active()
+  {
+    static std::atomic<int> active{0};
+    return active;
+  }
+
+  static LuaProfiler *Of(lua_State *L)
+  {
+    lua_getfield(L, LUA_REGISTRYINDEX, RegistryKey);
+    LuaProfiler *profiler = static_cast<LuaProfiler *>(lua_touserdata(L, -1));
+    lua_pop(L, 1);
+    return profiler && profiler->running ? profiler : nullptr;
+  }
+
+  static void Hook(lua_State *L, lua_Debug *ar)
+  {
+    LuaProfiler *profiler = Of(L);
+    if (profiler && ar->event == LUA_HOOKCOUNT)
+      profiler->Sample(L);
+    int mask = ar->event == LUA_HOOKTAILRET ? LUA_MASKRET : 1 << ar->event;
+    if (profiler && profiler->prevHook && (profiler->prevMask & mask))
+      profiler->prevHook(L, ar);
+  }
+
+  // charges the time since the last sample, minus binding time, to the running stack
+  void Sample(lua_State *thread)
+  {
+    Clock::time_point now = Clock::now();
+    Clock::duration elapsed = std::max(now - last - excluded, Clock::duration::zero());
+    Counters &counters = Lookup(thread, nullptr);
+    counters.stack->samples++;
+    counters.stack->time += elapsed;
+    charged += elapsed;
+    excluded = Clock::duration::zero();
+    last = Clock::now();
+  }
+
+  // An open binding call. Bindings that raise a lua error are left by
+  // longjmp without running ~BindingScope, so entries whose scope lived
+  // deeper on the C stack than a new one are stale and dropped.
+  struct Open
+  {
+    const void *scope;
+    lua_State *thread;
+    const char *name;
+    Clock::time_point start;
+    Clock::duration charged;
+  };
+
+  void Enter(const void *scope, lua_State *thread, const char *name)
+  {
+    while (!open.empty() && std::less_equal<const void *>()(open.back().scope, scope))
+      open.pop_back();
+    open.push_back({scope, thread, name ? name : "?", Clock::now(), charged});
+  }
+
+  void Leave(const void *scope)
+  {
+    if (open.empty() || open.back().scope != scope)
+      return;
+    Clock::time_point now = Clock::now();
+    const Open &call = open.back();
+    // time of lua code sampled while the binding called back into lua is already charged
+    Clock::duration self = std::max((now - call.start) - (charged - call.charged), Clock::duration::zero());
+    Counters &counters = Lookup(call.thread, call.name);
+    counters.stack->samples++;
+    counters.stack->time += self;
+    counters.binding->samples++;
+    counters.binding->time += self;
+    charged += self;
+    excluded += self + (Clock::now() - now);
+    open.pop_back();
+  }
+
+  struct Counters
+  {
+    LuaProfileEntry *stack;
+    LuaProfileEntry *binding;
+  };
+
+  // Finds the counters of the stack running on thread. The stack is keyed by
+  // the function of every frame and the leaf line, the readable collapsed
+  // stack is only built the first time a stack is seen.
+  // binding is the name of the binding at level 0, nullptr for a lua sample
+  Counters &Lookup(lua_State *thread, const char *binding)
+  {
+    raw.clear();
+    lua_Debug ar;
+    for (int level = 0; lua_getstack(thread, level, &ar); level++)
+    {
+      if (!lua_getinfo(thread, level == 0 ? "fl" : "f", &ar))
+        break;
+      const void *function = lua_topointer(thread, -1);
+      lua_pop(thread, 1);
+      raw.append(reinterpret_cast<const char *>(&function), sizeof(function));
+      if (level == 0)
+        raw.append(reinterpret_cast<const char *>(&ar.currentline), sizeof(ar.currentline));
+    }
+    auto found = known.find(raw);
+    if (found != known.end())
+      return found->second;
+
+    Counters counters{nullptr, nullptr};
+    if (binding)
+    {
+      // level 0 is the binding itself
+      Walk(thread, 1, false);
+      if (!key.empty())
+        key += ';';
+      key += "[C] ";
+      key += binding;
+      counters.binding = &bindingTotals[binding];
+    }
+    else
+      Walk(thread, 0, true);
+    counters.stack = &stacks[key];
+    return known.emplace(raw, counters).first->second;
+  }
+
+  // builds the collapsed stack of thread into key, outermost frame first
+  void Walk(lua_State *thread, int level, bool leafLine)
+  {
+    frames.clear();
+    lua_Debug ar;
+    bool leaf = leafLine;
+    for (; lua_getstack(thread, level, &ar); level++)
+    {
+      if (!lua_getinfo(thread, "Snl", &ar))
+        break;
+      if (leaf && ar.currentline > 0)
+        frames.push_back(std::string(ar.short_src) + ":" + std::to_string(ar.currentline));
+      leaf = false;
+      frames.push_back(Frame(ar));
+    }
+    key.clear();
+    for (auto it = frames.rbegin(); it != frames.rend(); ++it)
+    {
+      if (!key.empty())
+        key += ';';
+      key += *it;
+    }
+  }
+
+  static std::string Frame(const lua_Debug &ar)
+  {
+    if (ar.what[0] == 'C')
+      return std::string("[C] ") + (ar.name ? ar.name : "?");
+    if (ar.what[0] == 'm')
+      return std::string("main ") + ar.short_src;
+    return std::string(ar.name ? ar.name : "?") + " " + ar.short_src + ":" + std::to_string(ar.linedefined);
+  }
+
+  lua_State *L;
+  bool running = false;
+  int sampleInterval = 1000;
+  lua_Hook prevHook = nullptr;
+  int prevMask = 0;
+  int prevCount = 0;
+  Clock::time_point last;
+  Clock::duration excluded{0}; // binding time since the last sample
+  Clock::duration charged{0};  // all time charged so far
+  std::vector<Open> open;
+  std::unordered_map<std::string, LuaProfileEntry> stacks;
+  std::unordered_map<std::string, LuaProfileEntry> bindingTotals;
+  std::unordered_map<std::string, Counters> known; // raw stack -> counters
+  std::string raw;
+  std::string key;
+  std::vector<std::string> frames;
+};
@@ -0,0 +1,519 @@
+// Copyright (C) 2023 Theros < MisModding | SvalTek >
+//
+// This file is part of LuaBinder.
+//
+// LuaBinder is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LuaBinder is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LuaBinder.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+#include "LuaScript.h"
+#include <chrono>
+#include <memory>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <queue>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// ─── LuaSuspend ──────────────────────────────────────────────────────────────
+
+// struct LuaSuspend
+// Returned by a bound function to suspend the script that called it, the
+// script continues once the scheduler resumes it:
+//
+//   LuaSuspend wait(double s) { return LuaSuspend::sleep(s); }
+//   LuaFunction<LuaSuspend(double)>::Register<&wait>(L, "wait");
+//
+// Only scripts started with LuaScheduler::spawn can be suspended. Lua 5.1
+// can't yield across pcall, metamethods or iterators, calling a suspending
+// function from inside one of those raises an error.
+struct LuaSuspend
+{
+  using Clock = std::chrono::steady_clock;
+  // pushes the values the suspended call returns, or returns -1 while not ready
+  using Poller = std::function<int(lua_State *)>;
+
+  enum Kind
+  {
+    Yield,    // resume on the next step
+    Timer,    // resume at `at`
+    Poll,     // resume once `poll` is ready
+    External, // resume with LuaScheduler::wake
+  };
+
+  Kind kind = Yield;
+  Clock::time_point at;
+  Poller poll;
+
+  static LuaSuspend yield() { return LuaSuspend(); }
+
+  static LuaSuspend sleep(double seconds)
+  {
+    return until(Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds)));
+  }
+
+  static LuaSuspend until(Clock::time_point time)
+  {
+    LuaSuspend s;
+    s.kind = Timer;
+    s.at = time;
+    return s;
+  }
+
+  /** Resume once the future is ready, the call returns its value */
+  template <typename T>
+  static LuaSuspend future(std::shared_future<T> f)
+  {
+    LuaSuspend s;
+    s.kind = Poll;
+    s.poll = [f](lua_State *L) -> int {
+      if (f.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        return -1;
+      if constexpr (std::is_void<T>::value)
+        return 0;
+      else
+      {
+        LuaStack<LuaArg<T>>::push(L, f.get());
+        return 1;
+      }
+    };
+    return s;
+  }
+
+  /** Resume when the host calls LuaScheduler::wake for the task */
+  static LuaSuspend external()
+  {
+    LuaSuspend s;
+    s.kind = External;
+    return s;
+  }
+};
+
+// yields the calling task, defined with LuaScheduler
+inline int LuaSchedulerSuspend(lua_State *L, const LuaSuspend &s);
+
+// LuaReturn for LuaSuspend
+// a bound function returning LuaSuspend yields the calling script
+template <>
+struct LuaReturn<LuaSuspend>
+{
+  static constexpr int count = 0;
+  static int push(lua_State *L, const LuaSuspend &s) { return LuaSchedulerSuspend(L, s); }
+};
+
+// ─── LuaScheduler ────────────────────────────────────────────────────────────
+
+// class LuaScheduler
+// Runs scripts as coroutines of one lua_State. step() fires due timers,
+// polls pending futures and resumes every ready script once, so a script
+// that sleeps or waits never blocks the thread driving the scheduler.
+// Each task costs one lua thread, tens of thousands of suspended tasks per
+// state are fine. The scheduler is not thread safe, drive it from the
+// thread that owns the state and complete cross-thread work through futures.
+class LuaScheduler
+{
+public:
+  using Clock = LuaSuspend::Clock;
+  using TaskId = uint64_t;
+  using ErrorHandler = std::function<void(TaskId, const std::string &)>;
+
+  explicit LuaScheduler(lua_State *L) : L(L)
+  {
+    lua_pushlightuserdata(L, this);
+    lua_setfield(L, LUA_REGISTRYINDEX, RegistryKey);
+  }
+
+  ~LuaScheduler()
+  {
+    for (auto &entry : tasks)
+    {
+      if (entry.second.meter)
+        entry.second.meter->detach();
+      luaL_unref(L, LUA_REGISTRYINDEX, entry.second.ref);
+    }
+    lua_pushnil(L);
+    lua_setfield(L, LUA_REGISTRYINDEX, RegistryKey);
+  }
+
+  LuaScheduler(const LuaScheduler &) = delete;
+  LuaScheduler &operator=(const LuaScheduler &) = delete;
+
+  /** Register sleep(seconds) and yield() as globals for scheduled scripts */
+  void registerGlobals()
+  {
+    LuaFunction<LuaSuspend(double)>::Register<&LuaSuspend::sleep>(L, "sleep");
+    LuaFunction<LuaSuspend()>::Register<&LuaSuspend::yield>(L, "yield");
+  }
+
+  /** Give every task spawned from now on its own execution budget per resume
+   * with LuaBudget::Yield a task over budget goes back to the end of the ready
+   * queue, with Abort it fails with an error
+   */
+  void setBudget(const LuaBudget &budget) { taskBudget = budget; }
+
+  /** Get the budget accounting of a live task, nullptr if it has no budget */
+  const LuaBudgetUsage *usage(TaskId id) const
+  {
+    auto it = tasks.find(id);
+    return it != tasks.end() && it->second.meter ? &it->second.meter->usage() : nullptr;
+  }
+
+  /** Get the budget accounting summed over every finished task */
+  const LuaBudgetUsage &finishedUsage() const { return finished; }
+
+  /** Called with the task and message when a script raises an error, the default logs it */
+  void setErrorHandler(ErrorHandler handler) { onError = std::move(handler); }
+
+  /** Start a function as a new task, it first runs on the next step
+   * @return The task id, 0 if function is not a function
+   */
+  template <typename... Args>
+  TaskId spawn(const LuaRef &function, const Args &...args)
+  {
+    if (function.type() != LUA_TFUNCTION)
+    {
+      LUA_LOG(LUA_LOG_ERROR, "LuaScheduler: spawn needs a function");
+      return 0;
+    }
+    lua_State *thread = NewThread();
+    function.push(thread);
+    (LuaStack<LuaArg<Args>>::push(thread, args), ...);
+    return Queue(thread, static_cast<int>(sizeof...(Args)));
+  }
+
+  TaskId spawn(const LuaChunk &chunk) { return spawn(chunk.reference()); }
+
+  /** Compile and start lua code as a new task
+   * @return The task id, 0 if the code does not compile
+   */
+  TaskId spawn(const std::string &source, const std::string &chunkname = "")
+  {
+    const std::string &name = chunkname.empty() ? source : chunkname;
+    if (luaL_loadbuffer(L, source.data(), source.size(), name.c_str()))
+    {
+      LUA_LOG(LUA_LOG_ERROR, "LuaScheduler: " << lua_tostring(L, -1));
+      lua_pop(L, 1);
+      return 0;
+    }
+    return spawn(LuaRef::fromTop(L));
+  }
+
+  /** Resume a task suspended with LuaSuspend::external
+   * @param args returned to the script by the suspended call
+   * @return false if the task is not waiting for a wake
+   */
+  template <typename... Args>
+  bool wake(TaskId id, const Args &...args)
+  {
+    auto it = tasks.find(id);
+    if (it == tasks.end() || it->second.wait != LuaSuspend::External)
+      return false;
+    Task &task = it->second;
+    (LuaStack<LuaArg<Args>>::push(task.thread, args), ...);
+    task.wait = LuaSuspend::Yield;
+    ready.push_back({id, static_cast<int>(sizeof...(Args))});
+    return true;
+  }
+
+  /** Stop a task, it is never resumed again
+   * a task cancelled while it runs, e.g. by a binding it called, is finished
+   * when it next yields or returns
+   */
+  bool cancel(TaskId id)
+  {
+    auto it = tasks.find(id);
+    if (it == tasks.end() || it->second.cancelled)
+      return false;
+    if (it->second.running)
+      it->second.cancelled = true;
+    else
+      Finish(it);
+    return true;
+  }
+
+  /** Run one round
+   * @param now time used for timers
+   * @return The number of tasks resumed
+   */
+  size_t step(Clock::time_point now = Clock::now())
+  {
+    while (!timers.empty() && timers.top().at <= now)
+    {
+      TimerEntry t = timers.top();
+      timers.pop();
+      auto it = tasks.find(t.id);
+      if (it != tasks.end() && it->second.wait == LuaSuspend::Timer && it->second.at == t.at)
+      {
+        it->second.wait = LuaSuspend::Yield;
+        ready.push_back({t.id, 0});
+      }
+    }
+
+    for (size_t i = 0; i < polling.size();)
+    {
+      auto it = tasks.find(polling[i]);
+      int results = -1;
+      if (it == tasks.end() || (results = it->second.poll(it->second.thread)) >= 0)
+      {
+        if (it != tasks.end())
+        {
+          it->second.wait = LuaSuspend::Yield;
+          it->second.poll = nullptr;
+          ready.push_back({polling[i], results});
+        }
+        polling[i] = polling.back();
+        polling.pop_back();
+        continue;
+      }
+      i++;
+    }
+
+    // tasks made ready while this round runs wait for the next one
+    size_t count = ready.size();
+    size_t resumed = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+      ReadyEntry entry = ready.front();
+      ready.pop_front();
+      if (tasks.find(entry.id) == tasks.end())
+        continue;
+      Resume(entry.id, entry.args);
+      resumed++;
+    }
+    return resumed;
+  }
+
+  /** Step until every task finished or only tasks waiting for wake are left,
+   * sleeping while only timers are pending, futures are polled every millisecond
+   */
+  void run()
+  {
+    while (!tasks.empty())
+    {
+      step();
+      if (!ready.empty())
+        continue;
+      if (timers.empty() && polling.empty())
+        break;
+      Clock::time_point wake = Clock::now() + std::chrono::milliseconds(polling.empty() ? 100 : 1);
+      if (!timers.empty() && timers.top().at < wake)
+        wake = timers.top().at;
+      std::this_thread::sleep_until(wake);
+    }
+  }
+
+  size_t size() const { return tasks.size(); }
+  bool empty() const { return tasks.empty(); }
+
+  /** Get the earliest timer, the host can sleep until then when nothing is ready */
+  bool nextTimer(Clock::time_point &at) const
+  {
+    if (timers.empty())
+      return false;
+    at = timers.top().at;
+    return true;
+  }
+
+  /** Get the scheduler driving L, nullptr if none */
+  static LuaScheduler *of(lua_State *L)
+  {
+    lua_getfield(L, LUA_REGISTRYINDEX, RegistryKey);
+    LuaScheduler *scheduler = static_cast<LuaScheduler *>(lua_touserdata(L, -1));
+    lua_pop(L, 1);
+    return scheduler;
+  }
+
+  /** Get the task running on thread L, 0 if L is not a scheduled task */
+  TaskId current(lua_State *thread) const
+  {
+    auto it = byThread.find(thread);
+    return it == byThread.end() ? 0 : it->second;
+  }
+
+  // Suspend
+  // Yields the calling task, used by LuaReturn<LuaSuspend>. Lua 5.1 can't
+  // tell beforehand whether the yield will fail (inside a pcall, a metamethod
+  // or an iterator), and a failed yield raises an error the script may catch.
+  // So the request is only stored here and the yield carries a marker; Resume
+  // queues the task when it sees the marker, i.e. once the yield happened.
+  static int Suspend(lua_State *L, const LuaSuspend &s)
+  {
+    LuaScheduler *scheduler = of(L);
+    TaskId id = scheduler ? scheduler->current(L) : 0;
+    if (!id)
+      return luaL_error(L, "can't suspend, the script was not started by a LuaScheduler");
+    scheduler->tasks[id].request = s;
+    lua_pushlightuserdata(L, const_cast<char *>(&SuspendMarker));
+    return lua_yield(L, 1);
+  }
+
+private:
+  static constexpr const char *RegistryKey = "LuaBinder.LuaScheduler";
+  static constexpr char SuspendMarker = 0;
+
+  struct Task
+  {
+    lua_State *thread = nullptr;
+    int ref = LUA_NOREF;
+    LuaSuspend::Kind wait = LuaSuspend::Yield;
+    Clock::time_point at;
+    LuaSuspend::Poller poll;
+    LuaSuspend request; // the last Suspend, applied once its yield happened
+    std::unique_ptr<LuaBudgetMeter> meter;
+    bool running = false;
+    bool cancelled = false; // by cancel() while running
+
+  };
+
+  struct TimerEntry
+  {
+    Clock::time_point at;
+    TaskId id;
+    bool operator>(const TimerEntry &other) const { return at > other.at; }
+  };
+
+  struct ReadyEntry
+  {
+    TaskId id;
+    int args;
+  };
+
+  // a new thread anchored in the registry until the task finishes
+  lua_State *NewThread()
+  {
+    lua_State *thread = lua_newthread(L);
+    pendingRef = luaL_ref(L, LUA_REGISTRYINDEX);
+    return thread;
+  }
+
+  TaskId Queue(lua_State *thread, int args)
+  {
+    TaskId id = ++lastId;
+    Task &task = tasks[id];
+    task.thread = thread;
+    task.ref = pendingRef;
+    if (taskBudget.limited())
+    {
+      task.meter = std::make_unique<LuaBudgetMeter>(taskBudget);
+      task.meter->attach(thread);
+    }
+    byThread[thread] = id;
+    ready.push_back({id, args});
+    return id;
+  }
+
+  void Resume(TaskId id, int args)
+  {
+    auto it = tasks.find(id);
+    lua_State *thread = it->second.thread;
+    int status;
+    it->second.running = true;
+    {
+      LuaBudgetMeter::Scope budget(it->second.meter.get());
+      LuaProfiler::Mark(thread);
+      status = lua_resume(thread, args);
+    }
+    // the script may have spawned or cancelled tasks, iterators are stale
+    it = tasks.find(id);
+    it->second.running = false;
+    if (it->second.cancelled)
+    {
+      Finish(it);
+      return;
+    }
+    if (status == LUA_YIELD)
+    {
+      if (lua_gettop(thread) > 0 && lua_touserdata(thread, -1) == &SuspendMarker)
+      {
+        lua_pop(thread, 1);
+        Wait(it);
+      }
+      // coroutine.yield from the script itself, or a LuaSuspend::yield
+      if (it->second.wait == LuaSuspend::Yield)
+      {
+        lua_settop(thread, 0);
+        ready.push_back({it->first, 0});
+      }
+      return;
+    }
+    if (status != 0)
+    {
+      std::string message = lua_isstring(thread, -1) ? lua_tostring(thread, -1) : "error object is not a string";
+      if (onError)
+      {
+        onError(id, message);
+        // the handler may have cancelled the task already
+        it = tasks.find(id);
+        if (it == tasks.end())
+          return;
+      }
+      else
+        LUA_LOG(LUA_LOG_ERROR, "LuaScheduler: task " << id << ": " << message);
+    }
+    Finish(it);
+  }
+
+  // queues a task that yielded through Suspend by its request
+  void Wait(std::unordered_map<TaskId, Task>::iterator it)
+  {
+    Task &task = it->second;
+    LuaSuspend request = std::move(task.request);
+    task.request = LuaSuspend();
+    task.wait = request.kind;
+    if (request.kind == LuaSuspend::Timer)
+    {
+      task.at = request.at;
+      timers.push({request.at, it->first});
+    }
+    else if (request.kind == LuaSuspend::Poll)
+    {
+      task.poll = std::move(request.poll);
+      polling.push_back(it->first);
+    }
+  }
+
+  void Finish(std::unordered_map<TaskId, Task>::iterator it)
+  {
+    if (LuaBudgetMeter *meter = it->second.meter.get())
+    {
+      const LuaBudgetUsage &u = meter->usage();
+      finished.instructions += u.instructions;
+      finished.wallTime += u.wallTime;
+      finished.invocations += u.invocations;
+      finished.exceeded += u.exceeded;
+      meter->detach();
+    }
+    byThread.erase(it->second.thread);
+    luaL_unref(L, LUA_REGISTRYINDEX, it->second.ref);
+    tasks.erase(it);
+  }
+
+  lua_State *L;
+  TaskId lastId = 0;
+  int pendingRef = LUA_NOREF;
+  std::unordered_map<TaskId, Task> tasks;
+  std::unordered_map<lua_State *, TaskId> byThread;
+  std::deque<ReadyEntry> ready;
+  std::priority_queue<TimerEntry, std::vector<TimerEntry>, std::greater<TimerEntry>> timers;
+  std::vector<TaskId> polling;
+  ErrorHandler onError;
+  LuaBudget taskBudget;
+  LuaBudgetUsage finished;
+};
+
+inline int LuaSchedulerSuspend(lua_State *L, const LuaSuspend &s)
+{
+  return LuaScheduler::Suspend(L, s);
+}
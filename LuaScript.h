@@ -16,6 +16,16 @@
 // along with EzConsole.  If not, see <http://www.gnu.org/licenses/>.
 #pragma once
 #include "Lua.hpp"
+#include "LuaAllocator.h"
+#include "LuaBudget.h"
+#include "LuaChunkCache.h"
+#include "LuaMetrics.h"
+#include "LuaProfiler.h"
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
 
 // ─── LuaFunction ─────────────────────────────────────────────────────────────
 template <typename Sig>
@@ -25,506 +35,2037 @@ struct LuaFunction;
 template <typename Ret, typename... Args>
 bool lua_push(lua_State *L, LuaFunction<Ret(Args...)> &func)
 {
-    std::cout << "lua_push: [LuaFunction] " << typeid(LuaFunction<Ret(Args...)>).name() << ", pushing function as userdata" << std::endl;
+    LUA_LOG(LUA_LOG_TRACE, "lua_push: [LuaFunction] " << typeid(LuaFunction<Ret(Args...)>).name() << ", pushing function as userdata");
     lua_pushlightuserdata(L, (void *)&func);
     return true;
 }
 
+// LuaArg
+// the type LuaStack is specialized on for a bound argument or return value
+template <typename T>
+using LuaArg = typename std::remove_cv<typename std::remove_reference<T>::type>::type;
+
 template <typename Ret, typename... Args>
 struct LuaFunction<Ret(Args...)>
 {
+  using FunctionPtr = Ret (*)(Args...);
+
   std::function<Ret(Args...)> func;
+  // set when constructed from a plain function or a captureless lambda,
+  // lets Register bind the pointer instead of the std::function
+  FunctionPtr fptr = nullptr;
 
-  template <typename F>
-  LuaFunction(F &&f) : func(std::forward<F>(f)) {}
-  LuaFunction(Ret (*f)(Args...)) : func(f) {}
+  template <typename F, typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, LuaFunction>::value>::type>
+  LuaFunction(F &&f) : func(std::forward<F>(f))
+  {
+    if constexpr (std::is_convertible<F, FunctionPtr>::value)
+      fptr = static_cast<FunctionPtr>(f);
+  }
+  LuaFunction(Ret (*f)(Args...)) : func(f), fptr(f) {}
 
   Ret operator()(Args... args)
   {
     return func(args...);
   }
 
+  /** Register the wrapped function as a global
+   * plain functions are bound by pointer, anything else stores a copy of the
+   * std::function in the closure, the LuaFunction itself may go out of scope
+   * @param L lua_State to register the function in
+   * @param name global name of the function
+   */
   void Register(lua_State *L, const char *name)
   {
     // check if lua_State pointer is valid
     if (!L)
     {
-      std::cerr << "Error: Invalid lua_State pointer" << std::endl;
+      LUA_LOG(LUA_LOG_ERROR, "LuaFunction: Invalid lua_State pointer");
       return;
     }
     // check if name is valid
     if (!name || name[0] == '\0')
     {
-      std::cerr << "Error: Invalid function name" << std::endl;
+      LUA_LOG(LUA_LOG_ERROR, "LuaFunction: Invalid function name");
       return;
     }
     // check if the function object is valid
     if (!func)
     {
-      std::cerr << "Error: Invalid function object" << std::endl;
+      LUA_LOG(LUA_LOG_ERROR, "LuaFunction: Invalid function object [" << name << "]");
       return;
     }
-    // push a new userdata to the stack
-    LuaFunction<Ret(Args...)> *f = static_cast<LuaFunction<Ret(Args...)> *>(lua_newuserdata(L, sizeof(LuaFunction<Ret(Args...)>)));
-    // initialize the userdata
-    new (f) LuaFunction<Ret(Args...)>(func);
-    // push the function to the stack
-    lua_pushcclosure(
-        L, [](lua_State *L) -> int
-        {
-            // get the function object from upvalue
-            LuaFunction<Ret(Args...)> &f = *static_cast<LuaFunction<Ret(Args...)> *>(lua_touserdata(L, lua_upvalueindex(1)));
-            // check number of arguments
-            if (lua_gettop(L) != sizeof...(Args))
-            {
-                std::cerr << "Error: Invalid number of arguments expected " << sizeof...(Args) << ", got " << lua_gettop(L) << std::endl;
-                return 0;
-            }
-            // get the function name
-            std::string name = lua_tostring(L, lua_upvalueindex(2));
-            // check if the function name is valid
-            if (name.empty())
-            {
-                std::cerr << "Error: Invalid/Missing function name" << std::endl;
-                return 0;
-            }
-            // get the arguments from the stack
-            std::tuple<Args...> args;
-            int i = 0;
-            std::apply([&](auto &... args) { ((args = lua_get<Args>(L, -++i)), ...); }, args);
-            if constexpr (!std::is_void<Ret>::value)
-            {
-              // call the function
-              Ret ret = std::apply([&](auto &&... args){
-                  return f.func(args...);
-              }, args);
-              // push the return value to the stack
-              lua_set(L, ret, -1);
-              // return the number of return values
-              return 1;
-            } else {
-              // call the function
-              std::apply([&](auto &&... args){
-                  return f.func(args...);
-              }, args);
-              // push nil to the stack
-              lua_pushnil(L);
-              // return the number of return values
-              return 0;
-            }},
-        2);
-    // set the function name as the key
+    if (fptr)
+      PushClosure(L, fptr, name);
+    else
+      PushClosure(L, func, name);
     lua_setglobal(L, name);
-    // pop the userdata from the stack
-    lua_pop(L, 1);
-    // push the function to the stack
-    lua_getglobal(L, name);
-    // push the function object to the stack
-    lua_push(L, this);
-    // set the upvalue
-    lua_setupvalue(L, -2, 1);
-    // push the function name to the stack
-    lua_pushstring(L, name);
-    // set the upvalue
-    lua_setupvalue(L, -2, 2);
-    // pop the function from the stack
-    lua_pop(L, 1);
   }
-};
-
-// Construct a LuaFunction from any callable
-template <typename F>
-LuaFunction(F &&f) -> LuaFunction<decltype(std::forward<F>(f))>;
-
-// Construct a LuaFunction from a raw function pointer
-template <typename Ret, typename... Args>
-LuaFunction(Ret (*)(Args...)) -> LuaFunction<Ret(Args...)>;
-
-// ─── LuaScript ───────────────────────────────────────────────────────────────
-class LuaScript
-{
-public:
-  LuaScript(lua_State *L);
-  LuaScript(const std::string &filename);
-  ~LuaScript();
-  void printError(const std::string &variableName, const std::string &reason);
 
-  /** Get the current lua_State
-   * @return The current lua_State
+  /** Register a function known at compile time
+   * generates a lua_CFunction that calls Fn directly, e.g.
+   * LuaFunction<int(int, int)>::Register<&add>(L, "add")
+   * @param L lua_State to register the function in
+   * @param name global name of the function
    */
-  lua_State *State() { return this->L; }
-
-  // runString
-  // Runs the lua code stored in the string
-  bool runString(const std::string &str)
-  {
-    // Attempt to execute the string as Lua code
-    if (luaL_loadstring(this->L, str.c_str()) || lua_pcall(this->L, 0, 0, 0))
-    {
-      // Print an error message if the string could not be executed
-      std::cout << "Error: failed to load string ::\r\n " << str << std::endl;
-      return false;
-    }
-    return true;
-  }
-
-  // runFile
-  // Runs the lua code stored in the file
-  bool runFile(const std::string &filename)
+  template <FunctionPtr Fn>
+  static void Register(lua_State *L, const char *name)
   {
-    if (luaL_loadfile(this->L, filename.c_str()) || lua_pcall(this->L, 0, 0, 0))
-    {
-      std::cout << "Error: failed to load file :: '" << filename << "'" << std::endl;
-      return false;
-    }
-    return true;
+    lua_pushstring(L, name);
+    LuaMetrics::PushUpvalue(L, name);
+    lua_pushcclosure(L, &StaticCall<Fn>, 2);
+    lua_setglobal(L, name);
   }
 
-  inline void clean()
+  /** Register any callable without going through std::function
+   * the callable is stored inline in a userdata upvalue, stateful callables
+   * get a __gc that runs their destructor when the closure is collected
+   * @param L lua_State to register the function in
+   * @param name global name of the function
+   * @param f the callable to bind
+   */
+  template <typename F>
+  static void Register(lua_State *L, const char *name, F &&f)
   {
-    int n = lua_gettop(L);
-    lua_pop(L, n);
+    PushClosure(L, std::forward<F>(f), name);
+    lua_setglobal(L, name);
   }
 
-  bool lua_gettostack(const std::string &variableName)
+  /** Push a closure calling f onto the stack
+   * @param L lua_State to push to
+   * @param f the callable to bind
+   * @param name function name, only read when reporting errors
+   */
+  template <typename F>
+  static void PushClosure(lua_State *L, F &&f, const char *name)
   {
-    level = 0;
-    std::string var = "";
-    for (unsigned int i = 0; i < variableName.size(); i++)
+    using Stored = typename std::decay<F>::type;
+    static_assert(alignof(Stored) <= alignof(double), "LuaFunction: callable is over-aligned for a userdata");
+    void *storage = lua_newuserdata(L, sizeof(Stored));
+    new (storage) Stored(std::forward<F>(f));
+    if constexpr (!std::is_trivially_destructible<Stored>::value)
     {
-      if (variableName.at(i) == '.')
+      if (luaL_newmetatable(L, typeid(Stored).name()))
       {
-        if (level == 0)
-        {
-          lua_getglobal(L, var.c_str());
-        }
-        else
-        {
-          lua_getfield(L, -1, var.c_str());
-        }
-
-        if (lua_isnil(L, -1))
-        {
-          printError(variableName, var + " is not defined");
-          return false;
-        }
-        else
-        {
-          var = "";
-          level++;
-        }
-      }
-      else
-      {
-        var += variableName.at(i);
+        lua_pushcfunction(L, &Collect<Stored>);
+        lua_setfield(L, -2, "__gc");
       }
+      lua_setmetatable(L, -2);
     }
-    if (level == 0)
-    {
-      lua_getglobal(L, var.c_str());
-    }
-    else
-    {
-      lua_getfield(L, -1, var.c_str());
-    }
-    if (lua_isnil(L, -1))
-    {
-      printError(variableName, var + " is not defined");
-      return false;
-    }
+    lua_pushstring(L, name);
+    LuaMetrics::PushUpvalue(L, name);
+    lua_pushcclosure(L, &ClosureCall<Stored>, 3);
+  }
 
-    return true;
+private:
+  // StaticCall
+  // trampoline for a function pointer known at compile time,
+  // upvalues are the name and the LuaBindingMetrics
+  template <FunctionPtr Fn>
+  static int StaticCall(lua_State *L)
+  {
+    auto *metrics = static_cast<LuaBindingMetrics *>(lua_touserdata(L, lua_upvalueindex(2)));
+    if (lua_gettop(L) != static_cast<int>(sizeof...(Args)))
+      return ArityError(L, 1, metrics);
+    LuaBindingMetrics::Scope measure(metrics);
+    LuaProfiler::BindingScope profile(L, lua_upvalueindex(1));
+    return Invoke(L, Fn, std::index_sequence_for<Args...>{});
   }
 
-  template <typename T>
-  bool lua_is(lua_State *L, int index)
+  // ClosureCall
+  // trampoline for a callable stored in the first upvalue,
+  // followed by the name and the LuaBindingMetrics
+  template <typename F>
+  static int ClosureCall(lua_State *L)
   {
-    switch (lua_type(L, index))
-    {
-    case LUA_TSTRING:
-      return std::is_same<T, std::string>::value;
-    case LUA_TBOOLEAN:
-      return std::is_same<T, bool>::value;
-    case LUA_TNUMBER:
-      return std::is_same<T, int>::value || std::is_same<T, double>::value;
-    case LUA_TTABLE:
-      return std::is_same<T, std::vector<std::string>>::value || std::is_same<T, std::vector<int>>::value || std::is_same<T, std::vector<double>>::value || std::is_same<T, std::vector<bool>>::value;
-    case LUA_TFUNCTION:
-      return std::is_same<T, lua_CFunction>::value;
-    case LUA_TUSERDATA:
-      return std::is_same<T, void *>::value;
-    default:
-      return false;
-    }
+    auto *metrics = static_cast<LuaBindingMetrics *>(lua_touserdata(L, lua_upvalueindex(3)));
+    if (lua_gettop(L) != static_cast<int>(sizeof...(Args)))
+      return ArityError(L, 2, metrics);
+    LuaBindingMetrics::Scope measure(metrics);
+    LuaProfiler::BindingScope profile(L, lua_upvalueindex(2));
+    F &f = *static_cast<F *>(lua_touserdata(L, lua_upvalueindex(1)));
+    return Invoke(L, f, std::index_sequence_for<Args...>{});
   }
 
-  template <typename T>
-  T global_getdefault()
+  // Collect
+  // __gc for stored callables
+  template <typename F>
+  static int Collect(lua_State *L)
   {
+    static_cast<F *>(lua_touserdata(L, 1))->~F();
     return 0;
   }
 
-  template <typename T>
-  T global_get(const std::string &variableName)
+  // Invoke
+  // reads the arguments in order from the stack, calls f and pushes the result,
+  // a std::tuple or std::pair result is returned as multiple values
+  template <typename F, std::size_t... I>
+  static int Invoke(lua_State *L, F &&f, std::index_sequence<I...>)
   {
-    if (!L)
+    if constexpr (std::is_void<Ret>::value)
     {
-      printError(variableName, "Script is not loaded");
-      return global_getdefault<T>();
-    }
-
-    LuaPrintStack(L);
-
-    T result;
-    if (lua_gettostack(variableName))
-    { // variable succesfully on top of stack
-      result = lua_get<T>(L);
+      f(LuaStack<LuaArg<Args>>::get(L, static_cast<int>(I) + 1)...);
+      return 0;
     }
     else
     {
-      result = global_getdefault<T>();
+      return LuaReturn<LuaArg<Ret>>::push(L, f(LuaStack<LuaArg<Args>>::get(L, static_cast<int>(I) + 1)...));
     }
+  }
 
-    clean();
-    return result;
+  // ArityError
+  // raises a lua error naming the function, the name lives in upvalue `nameUpvalue`
+  static int ArityError(lua_State *L, int nameUpvalue, LuaBindingMetrics *metrics)
+  {
+    if (metrics)
+      metrics->arityErrors.fetch_add(1, std::memory_order_relaxed);
+    return luaL_error(L, "%s: invalid number of arguments, expected %d, got %d",
+                      lua_tostring(L, lua_upvalueindex(nameUpvalue)), static_cast<int>(sizeof...(Args)), lua_gettop(L));
   }
+};
+
+// Construct a LuaFunction from any callable
+template <typename F>
+LuaFunction(F &&f) -> LuaFunction<decltype(std::forward<F>(f))>;
 
-  std::vector<std::string> getTableKeys(const std::string &name);
+// Construct a LuaFunction from a raw function pointer
+template <typename Ret, typename... Args>
+LuaFunction(Ret (*)(Args...)) -> LuaFunction<Ret(Args...)>;
 
-  template <typename T>
-  std::vector<T> GetList(const std::string &name);
+// ─── LuaPath ─────────────────────────────────────────────────────────────────
 
-  template <typename T>
-  void SetList(const std::string &name, const std::vector<T> &list);
+// class LuaPath
+// A dotted path ("config.window.width") split once into its segments.
+// The segments are interned per lua_State as a table of lua strings in the
+// registry, resolving the path then only does raw gets with those keys.
+// Every distinct path text is interned process wide when a LuaPath is built,
+// the address of the interned text is the registry key of the table, so no
+// lookup hashes a string. Interned
+// tables are shared by every LuaPath with the same text and live as long as
+// the lua_State.
+class LuaPath
+{
+public:
+  explicit LuaPath(const std::string &path);
+  explicit LuaPath(const char *path) : LuaPath(std::string(path)) {}
 
-  template <typename T, typename U>
-  std::map<T, U> GetMap(const std::string &name);
+  /** Get the path as it was written
+   * @return The dotted path
+   */
+  const std::string &str() const { return path; }
 
-  template <typename T, typename U>
-  void SetMap(const std::string &name, const std::map<T, U> &map);
+  /** Get the segments of the path
+   * @return The segments in lookup order
+   */
+  const std::vector<std::string> &segments() const { return parts; }
 
-  // Get the last error from lua
-  std::string GetError()
-  {
-    if (!lua_isstring(L, -1))
-      return {};
- 
-    std::string err = lua_tostring(L, -1);
-    lua_pop(L, 1);
-    return err;
-  }
+  /** Push the value at the path onto the stack
+   * @param L lua_State to resolve in
+   * @return 0 and the value pushed on success, otherwise the 1-based index of
+   * the first segment that is not defined, with nothing pushed
+   */
+  size_t resolve(lua_State *L) const;
 
-private:
-  lua_State *L;
-  std::string filename;
-  int level;
-};
+  /** Pop the value on top of the stack and store it at the path
+   * @param L lua_State to assign in
+   * @return 0 on success, otherwise the 1-based index of the first segment
+   * that is not a table, the value is popped either way
+   */
+  size_t assign(lua_State *L) const;
 
-LuaScript::LuaScript(const std::string &filename)
-{
-  L = luaL_newstate();
-  if (luaL_loadfile(L, filename.c_str()) || lua_pcall(L, 0, 0, 0))
+private:
+  // the registry key of a path text, the same for every LuaPath with that
+  // text, interned texts are never freed so the address stays unique
+  static const void *Intern(const std::string &path)
   {
-    std::cout << "Error: failed to load (" << filename << ")" << std::endl;
-    L = 0;
-    return;
+    static std::mutex lock;
+    static std::unordered_set<std::string> texts;
+    std::lock_guard<std::mutex> guard(lock);
+    return &*texts.insert(path).first;
   }
 
-  if (L)
-    luaL_openlibs(L);
-}
+  // push the interned segment table for L
+  void pushSegments(lua_State *L) const;
+  // walk the first `count` segments from _G, leaves the segment table and the
+  // table reached on the stack
+  size_t walk(lua_State *L, size_t count) const;
 
-LuaScript::LuaScript(lua_State *L)
-{
-  this->L = L;
-  luaL_openlibs(L);
-}
+  std::string path;
+  std::vector<std::string> parts;
+  const void *key;
+};
 
-LuaScript::~LuaScript()
+LuaPath::LuaPath(const std::string &path) : path(path), key(Intern(path))
 {
-  if (L)
-    lua_close(L);
+  size_t start = 0;
+  for (;;)
+  {
+    size_t end = path.find('.', start);
+    if (end == std::string::npos)
+    {
+      parts.push_back(path.substr(start));
+      break;
+    }
+    parts.push_back(path.substr(start, end - start));
+    start = end + 1;
+  }
 }
 
-void LuaScript::printError(const std::string &variableName, const std::string &reason)
+void LuaPath::pushSegments(lua_State *L) const
 {
-  std::cout << "Error: can't get [" << variableName << "] > " << reason << std::endl;
-}
-
-std::vector<std::string> LuaScript::getTableKeys(const std::string &name)
-{
-  std::string code =
-      "function getKeys(name) "
-      "s = \"\""
-      "for k, v in pairs(_G[name]) do "
-      "    s = s..k..\",\" "
-      "    end "
-      "return s "
-      "end"; // function for getting table keys
-  luaL_loadstring(L,
-                  code.c_str()); // execute code
-  lua_pcall(L, 0, 0, 0);
-  lua_getglobal(L, "getKeys"); // get function
-  lua_pushstring(L, name.c_str());
-  lua_pcall(L, 1, 1, 0); // execute function
-  std::string test = lua_tostring(L, -1);
-  std::vector<std::string> strings;
-  std::string temp = "";
-  for (unsigned int i = 0; i < test.size(); i++)
-  {
-    if (test.at(i) != ',')
-    {
-      temp += test.at(i);
-    }
-    else
+  // registry[key] is the segment table, looked up on every call: a LuaPath
+  // may be shared by states on several threads and a closed state's address
+  // can be reused by a new one
+  lua_pushlightuserdata(L, const_cast<void *>(key));
+  lua_rawget(L, LUA_REGISTRYINDEX);
+  if (!lua_istable(L, -1))
+  {
+    lua_pop(L, 1);
+    lua_createtable(L, static_cast<int>(parts.size()), 0);
+    for (size_t i = 0; i < parts.size(); i++)
     {
-      strings.push_back(temp);
-      temp = "";
+      lua_pushlstring(L, parts[i].c_str(), parts[i].size());
+      lua_rawseti(L, -2, static_cast<int>(i + 1));
     }
+    lua_pushlightuserdata(L, const_cast<void *>(key));
+    lua_pushvalue(L, -2);
+    lua_rawset(L, LUA_REGISTRYINDEX);
   }
-  clean();
-  return strings;
 }
 
-// template GetList
-// Gets a List of values of type T in the lua state
-template <typename T>
-std::vector<T> LuaScript::GetList(const std::string &name)
+size_t LuaPath::walk(lua_State *L, size_t count) const
 {
-  std::vector<T> result;
-  if (!L)
+  pushSegments(L);
+  lua_pushvalue(L, LUA_GLOBALSINDEX);
+  for (size_t i = 1; i <= count; i++)
   {
-    printError(name, "No State");
-    return result;
-  }
-
-  if (lua_gettostack(name))
-  { // variable succesfully on top of stack
-    if (lua_istable(L, -1))
-    {                 // table on top of stack
-      lua_pushnil(L); // nil key on top of stack
-      while (lua_next(L, -2) != 0)
-      { // key and value on top of stack
-        if (lua_is<T>(L, -1))
-        { // value is of type T
-          result.push_back(lua_get<T>(L, -1));
-        }
-        else
-        {
-          // skip invalid value
-          break;
-        }
-        lua_pop(L, 1); // remove value, keep key for next iteration
-      }
-    }
-    else
+    lua_rawgeti(L, -2, static_cast<int>(i));
+    lua_rawget(L, -2);
+    if (!lua_istable(L, -1))
     {
-      printError(name, "is not a table");
+      lua_pop(L, 3);
+      return i;
     }
+    lua_replace(L, -2);
   }
-  clean();
-  return result;
+  return 0;
 }
 
-// template SetList
-// Sets a List of values of type T in the lua state
-template <typename T>
-void LuaScript::SetList(const std::string &name, const std::vector<T> &list)
+size_t LuaPath::resolve(lua_State *L) const
 {
-if (!L)
+  size_t failed = walk(L, parts.size() - 1);
+  if (failed)
+    return failed;
+  // segments, table
+  lua_rawgeti(L, -2, static_cast<int>(parts.size()));
+  lua_rawget(L, -2);
+  lua_replace(L, -3);
+  lua_pop(L, 1);
+  if (lua_isnil(L, -1))
   {
-    printError(name, "No State");
-    return;
+    lua_pop(L, 1);
+    return parts.size();
   }
+  return 0;
+}
 
-  lua_newtable(L);
-  for (size_t i = 0; i < list.size(); i++)
+size_t LuaPath::assign(lua_State *L) const
+{
+  size_t failed = walk(L, parts.size() - 1);
+  if (failed)
   {
-
-    lua_set(L, list[i]);
-    lua_rawseti(L, -2, i + 1);
-    LuaPrintStack(L);
+    lua_pop(L, 1);
+    return failed;
   }
-  lua_setglobal(L, name.c_str());
+  // value, segments, table
+  lua_rawgeti(L, -2, static_cast<int>(parts.size()));
+  lua_pushvalue(L, -4);
+  lua_rawset(L, -3);
+  lua_pop(L, 3);
+  return 0;
 }
 
-// template GetMap
-// Gets a Map of values of type T in the lua state
-template <typename T, typename U>
-std::map<T, U> LuaScript::GetMap(const std::string &name)
+// ─── LuaChunk ────────────────────────────────────────────────────────────────
+
+// class LuaChunk
+// A compiled chunk held in the registry, returned by LuaScript::compile.
+// Running it only pushes the function and calls lua_pcall, the source is
+// never parsed again. Arguments and results go through LuaStack.
+//
+//   LuaChunk scale = script.compile("local x, k = ... return x * k");
+//   double y = scale.call<double>(2.0, 1.5);
+class LuaChunk
 {
-  std::map<T, U> result;
-  if (!L)
+public:
+  LuaChunk() = default;
+  LuaChunk(LuaRef function, std::string name, LuaBudgetMeter *meter = nullptr)
+      : function(std::move(function)), chunkname(std::move(name)), meter(meter) {}
+
+  /** Check if the chunk compiled */
+  bool isValid() const { return function.state() != nullptr; }
+
+  /** Run the chunk, discarding its results
+   * @param args passed to the chunk as `...`
+   * @return false if the chunk is not valid or raised an error, see error()
+   */
+  template <typename... Args>
+  bool run(const Args &...args)
   {
-    printError(name, "No State");
-    return result;
+    return pcall(0, args...);
   }
 
-  if (lua_gettostack(name))
-  { // variable succesfully on top of stack
-    if (lua_istable(L, -1))
-    {                 // table on top of stack
-      lua_pushnil(L); // nil key on top of stack
-      while (lua_next(L, -2) != 0)
-      { // key and value on top of stack
-        if (lua_is<T>(L, -2) && lua_is<U>(L, -1))
-        { // value is of type T
-          result[lua_get<T>(L, -3)] = lua_get<U>(L, -2);
-        }
-        else
-        {
-          // skip invalid value
-          break;
-        }
-        lua_pop(L, 1); // remove value, keep key for next iteration
-      }
-    }
-    else
+  /** Run the chunk and get its result
+   * @param args passed to the chunk as `...`
+   * @return The first result as Ret, or all of them as a std::tuple / std::pair,
+   * Ret() on error or if a result is not a Ret (see error())
+   */
+  template <typename Ret, typename... Args>
+  Ret call(const Args &...args)
+  {
+    using Value = LuaArg<Ret>;
+    constexpr int results = LuaReturn<Value>::count;
+    if (!pcall(results, args...))
+      return Ret();
+    lua_State *L = function.state();
+    Value ret{};
+    if (LuaReturnTo(L, lua_gettop(L) - results + 1, ret) != 0)
     {
-      printError(name, "is not a table");
+      lastError = lua_tostring(L, -1);
+      lua_pop(L, results + 1);
+      LUA_LOG(LUA_LOG_ERROR, "LuaChunk: " << chunkname << ": " << lastError);
+      return Ret();
     }
+    lua_pop(L, results);
+    return ret;
   }
-  clean();
-  return result;
-}
 
-// template SetMap
-// Sets a Map of values of type T in the lua state
-template <typename T, typename U>
-void LuaScript::SetMap(const std::string &name, const std::map<T, U> &map)
-{
-  if (!L)
-  {
-    printError(name, "No State");
-    return;
-  }
+  /** Get the error of the last failed compile or run
+   * @return The lua error message, empty if there was none
+   */
+  const std::string &error() const { return lastError; }
+
+  const std::string &name() const { return chunkname; }
+  const LuaRef &reference() const { return function; }
 
-  lua_newtable(L);
-  for (auto it = map.begin(); it != map.end(); it++)
+  /** Make an invalid chunk carrying a compile error */
+  static LuaChunk failed(std::string name, std::string error)
   {
-    lua_push(L, it->first);
-    lua_push(L, it->second);
-    lua_settable(L, -3);
+    LuaChunk chunk;
+    chunk.chunkname = std::move(name);
+    chunk.lastError = std::move(error);
+    return chunk;
   }
-  lua_setglobal(L, name.c_str());
-}
 
-// ─── LuaTable ────────────────────────────────────────────────────────────────
+private:
+  // pushes the function and arguments and calls it with `results` results,
+  // on failure the stack is restored and the message kept in lastError
+  template <typename... Args>
+  bool pcall(int results, const Args &...args)
+  {
+    lua_State *L = function.state();
+    if (!L)
+      return false;
+    LuaBudgetMeter::Scope budget(meter && meter->budget().limited() ? meter : nullptr);
+    if (!lua_checkstack(L, static_cast<int>(sizeof...(Args)) + results + 1))
+    {
+      lastError = "stack overflow";
+      return false;
+    }
+    function.push();
+    (LuaStack<LuaArg<Args>>::push(L, args), ...);
+    LuaProfiler::Mark(L);
+    if (lua_pcall(L, static_cast<int>(sizeof...(Args)), results, 0))
+    {
+      lastError = lua_isstring(L, -1) ? lua_tostring(L, -1) : "error object is not a string";
+      lua_pop(L, 1);
+      LUA_LOG(LUA_LOG_ERROR, "LuaChunk: " << lastError);
+      return false;
+    }
+    lastError.clear();
+    return true;
+  }
+
+  LuaRef function;
+  std::string chunkname;
+  std::string lastError;
+  LuaBudgetMeter *meter = nullptr;
+};
+
+// ─── LuaBatch ────────────────────────────────────────────────────────────────
+
+// LuaBatchResult
+// outcome of one LuaBatch::run
+struct LuaBatchResult
+{
+  size_t calls = 0;                  // items the function was called for
+  size_t errors = 0;                 // calls that raised an error
+  size_t firstError = size_t(-1);    // index of the first failed item
+  std::string error;                 // message of the first failure
+
+  explicit operator bool() const { return errors == 0; }
+};
+
+template <typename Sig>
+class LuaBatch;
+
+// class LuaBatch
+// Calls one lua function over many argument tuples, e.g. a scoring
+// callback over every item of a tick:
+//
+//   LuaBatch<double(int, double)> score(L, "score");
+//   std::vector<std::tuple<int, double>> items = ...;
+//   std::vector<double> scores(items.size());
+//   LuaBatchResult r = score.run(items, scores.data());
+//
+// The function is resolved once on construction. Each run checks the stack
+// once and installs debug.traceback as the message handler once. A failed
+// item, a lua error or a result that is not a Ret, gets Ret() in the output
+// and the batch carries on unless stopOnError is set.
+template <typename Ret, typename... Args>
+class LuaBatch<Ret(Args...)>
+{
+public:
+  using Item = std::tuple<Args...>;
+
+  /** Resolve a global function, dotted paths are walked like LuaPath */
+  LuaBatch(lua_State *L, const std::string &name) : LuaBatch(L, LuaPath(name)) {}
+
+  LuaBatch(lua_State *L, const LuaPath &path)
+  {
+    if (path.resolve(L) == 0)
+      function = LuaRef::fromTop(L);
+    if (function.type() != LUA_TFUNCTION)
+    {
+      LUA_LOG(LUA_LOG_ERROR, "LuaBatch: [" << path.str() << "] is not a function");
+      function.reset();
+    }
+  }
+
+  explicit LuaBatch(LuaRef fn) : function(std::move(fn)) {}
+
+  bool isValid() const { return function.state() != nullptr; }
+
+  /** Stop at the first failing item instead of carrying on */
+  void setStopOnError(bool stop) { stopOnError = stop; }
+
+  /** Call the function for every item
+   * @param items argument tuples
+   * @param count number of items
+   * @param out receives one result per item, may be nullptr when Ret is void
+   */
+  LuaBatchResult run(const Item *items, size_t count, Ret *out = nullptr)
+  {
+    Frame frame{this, items, count, out, {}};
+    lua_State *L = function.state();
+    if (!L)
+    {
+      frame.result.error = "function not resolved";
+      frame.result.errors = count;
+      frame.result.firstError = count ? 0 : size_t(-1);
+      return frame.result;
+    }
+    int top = lua_gettop(L);
+    PushRun(L);
+    lua_pushlightuserdata(L, &frame);
+    if (lua_pcall(L, 1, 0, 0))
+    {
+      // out of stack or memory
+      frame.result.errors++;
+      if (frame.result.firstError == size_t(-1))
+      {
+        frame.result.firstError = frame.result.calls ? frame.result.calls - 1 : 0;
+        frame.result.error = lua_isstring(L, -1) ? lua_tostring(L, -1) : "error";
+      }
+      LUA_LOG(LUA_LOG_ERROR, "LuaBatch: " << frame.result.error);
+    }
+    lua_settop(L, top);
+    return frame.result;
+  }
+
+  /** Call the function for every item of a contiguous container */
+  template <typename Container>
+  LuaBatchResult run(const Container &items, Ret *out = nullptr)
+  {
+    return run(items.data(), items.size(), out);
+  }
+
+private:
+  using Value = typename std::conditional<std::is_void<Ret>::value, int, LuaArg<Ret>>::type;
+  static constexpr int Results = LuaReturn<Value>::count * !std::is_void<Ret>::value;
+
+  struct Frame
+  {
+    LuaBatch *batch;
+    const Item *items;
+    size_t count;
+    Ret *out;
+    LuaBatchResult result;
+  };
+
+  // the batch loop, runs inside one lua_pcall with the frame at 1
+  static int Run(lua_State *L)
+  {
+    Frame &frame = *static_cast<Frame *>(lua_touserdata(L, 1));
+    luaL_checkstack(L, static_cast<int>(sizeof...(Args)) + 2 * Results + 6, "LuaBatch");
+    // message handler, installed once for the whole batch
+    lua_getglobal(L, "debug");
+    if (lua_istable(L, -1))
+      lua_getfield(L, -1, "traceback");
+    else
+      lua_pushnil(L);
+    lua_remove(L, -2);
+    int handler = lua_isfunction(L, -1) ? lua_gettop(L) : 0;
+    frame.batch->function.push(L);
+    int fn = lua_gettop(L);
+    for (size_t i = 0; i < frame.count; i++)
+    {
+      lua_pushvalue(L, fn);
+      std::apply([L](const Args &...a) { (LuaStack<LuaArg<Args>>::push(L, a), ...); }, frame.items[i]);
+      frame.result.calls++;
+      int status = lua_pcall(L, static_cast<int>(sizeof...(Args)), Results, handler);
+      if constexpr (!std::is_void<Ret>::value)
+      {
+        if (status == 0 && frame.out)
+          status = Convert(L, fn + 1, frame.out[i]);
+      }
+      if (status)
+      {
+        frame.result.errors++;
+        if (frame.result.firstError == size_t(-1))
+        {
+          frame.result.firstError = i;
+          frame.result.error = lua_isstring(L, -1) ? lua_tostring(L, -1) : "error";
+        }
+        lua_settop(L, fn);
+        if constexpr (!std::is_void<Ret>::value)
+        {
+          if (frame.out)
+            frame.out[i] = Ret();
+        }
+        if (frame.batch->stopOnError)
+          break;
+        continue;
+      }
+      lua_settop(L, fn);
+    }
+    return 0;
+  }
+
+  // Converts the results at first into out, 0 on success. On a mismatch the
+  // message is pushed and a non-zero status returned, like lua_pcall. Types
+  // LuaResultIs can't check are converted in a protected call of their own.
+  static int Convert(lua_State *L, int first, Value &out)
+  {
+    if constexpr (LuaResultIs<Value>::known)
+    {
+      if (LuaResultIs<Value>::check(L, first))
+      {
+        out = LuaReturn<Value>::get(L, first);
+        return 0;
+      }
+      lua_pushfstring(L, "unexpected result type %s", luaL_typename(L, first));
+      return LUA_ERRRUN;
+    }
+    else
+    {
+      PushConvert(L);
+      lua_pushlightuserdata(L, &out);
+      for (int r = 0; r < Results; r++)
+        lua_pushvalue(L, first + r);
+      return lua_pcall(L, Results + 1, 0, 0);
+    }
+  }
+
+  // the protected half of Convert, the output as light userdata at 1
+  static int ConvertProtected(lua_State *L)
+  {
+    if constexpr (!std::is_void<Ret>::value)
+      *static_cast<Value *>(lua_touserdata(L, 1)) = LuaReturn<Value>::get(L, 2);
+    return 0;
+  }
+
+  static void PushConvert(lua_State *L)
+  {
+    static const char key = 0;
+    lua_pushlightuserdata(L, const_cast<char *>(&key));
+    lua_rawget(L, LUA_REGISTRYINDEX);
+    if (lua_isnil(L, -1))
+    {
+      lua_pop(L, 1);
+      lua_pushcfunction(L, &ConvertProtected);
+      lua_pushlightuserdata(L, const_cast<char *>(&key));
+      lua_pushvalue(L, -2);
+      lua_rawset(L, LUA_REGISTRYINDEX);
+    }
+  }
+
+  // the Run closure, created once per state and kept in the registry
+  static void PushRun(lua_State *L)
+  {
+    static const char key = 0;
+    lua_pushlightuserdata(L, const_cast<char *>(&key));
+    lua_rawget(L, LUA_REGISTRYINDEX);
+    if (lua_isnil(L, -1))
+    {
+      lua_pop(L, 1);
+      lua_pushcfunction(L, &Run);
+      lua_pushlightuserdata(L, const_cast<char *>(&key));
+      lua_pushvalue(L, -2);
+      lua_rawset(L, LUA_REGISTRYINDEX);
+    }
+  }
+
+  LuaRef function;
+  bool stopOnError = false;
+};
+
+// ─── Map containers ──────────────────────────────────────────────────────────
+
+// LuaStringHash
+// transparent string hash, lets a LuaUnorderedMap<std::string, V> be searched
+// with a std::string_view or const char * where the library supports it (C++20)
+struct LuaStringHash
+{
+  using is_transparent = void;
+  size_t operator()(std::string_view s) const { return std::hash<std::string_view>()(s); }
+};
+
+// LuaUnorderedMap
+// the hash map GetUnorderedMap fills
+template <typename K, typename V>
+using LuaUnorderedMap = typename std::conditional<std::is_same<K, std::string>::value,
+                                                  std::unordered_map<K, V, LuaStringHash, std::equal_to<>>,
+                                                  std::unordered_map<K, V>>::type;
+
+// class LuaFlatMap
+// A map stored as one vector of pairs sorted by key. Built once and then
+// only searched, it has no per-entry allocation and find() takes any type
+// comparable with the key, e.g. a std::string_view for std::string keys.
+template <typename K, typename V>
+class LuaFlatMap
+{
+public:
+  using value_type = std::pair<K, V>;
+  using iterator = typename std::vector<value_type>::iterator;
+  using const_iterator = typename std::vector<value_type>::const_iterator;
+
+  LuaFlatMap() = default;
+  LuaFlatMap(std::initializer_list<value_type> entries) : entries(entries) { sort(); }
+
+  template <typename Key>
+  const_iterator find(const Key &key) const
+  {
+    auto it = std::lower_bound(entries.begin(), entries.end(), key, [](const value_type &e, const Key &k) { return e.first < k; });
+    return it != entries.end() && !(key < it->first) ? it : entries.end();
+  }
+  template <typename Key>
+  iterator find(const Key &key)
+  {
+    auto it = std::lower_bound(entries.begin(), entries.end(), key, [](const value_type &e, const Key &k) { return e.first < k; });
+    return it != entries.end() && !(key < it->first) ? it : entries.end();
+  }
+
+  template <typename Key>
+  size_t count(const Key &key) const { return find(key) != end() ? 1 : 0; }
+
+  /** Get the value of key, throws std::out_of_range if it is missing */
+  template <typename Key>
+  const V &at(const Key &key) const
+  {
+    auto it = find(key);
+    if (it == end())
+      throw std::out_of_range("LuaFlatMap::at");
+    return it->second;
+  }
+
+  const_iterator begin() const { return entries.begin(); }
+  const_iterator end() const { return entries.end(); }
+  iterator begin() { return entries.begin(); }
+  iterator end() { return entries.end(); }
+  size_t size() const { return entries.size(); }
+  bool empty() const { return entries.empty(); }
+  void clear() { entries.clear(); }
+  void reserve(size_t n) { entries.reserve(n); }
+
+  /** Append an entry without keeping the order, call sort() after a bulk fill */
+  template <typename... Args>
+  void emplace_back(Args &&...args) { entries.emplace_back(std::forward<Args>(args)...); }
+
+  /** Restore the key order after emplace_back, the last of equal keys is kept */
+  void sort()
+  {
+    std::stable_sort(entries.begin(), entries.end(), [](const value_type &a, const value_type &b) { return a.first < b.first; });
+    auto out = entries.begin();
+    for (auto it = entries.begin(); it != entries.end(); ++it)
+    {
+      if (out != entries.begin() && !((out - 1)->first < it->first))
+        *(out - 1) = std::move(*it);
+      else
+      {
+        if (out != it)
+          *out = std::move(*it);
+        ++out;
+      }
+    }
+    entries.erase(out, entries.end());
+  }
+
+  const std::vector<value_type> &data() const { return entries; }
+
+private:
+  std::vector<value_type> entries;
+};
+
+// ─── LuaScript ───────────────────────────────────────────────────────────────
+class LuaScript
+{
+public:
+  LuaScript(lua_State *L);
+  LuaScript(const std::string &filename);
+  /** Create a state whose memory comes from an allocator policy
+   * the allocator is kept until the state is closed
+   * @param allocator e.g. std::make_unique<LuaPoolAllocator>()
+   */
+  explicit LuaScript(std::unique_ptr<LuaAllocator> allocator);
+  ~LuaScript();
+  void printError(const std::string &variableName, const std::string &reason);
+
+  /** Get the current lua_State
+   * @return The current lua_State
+   */
+  lua_State *State() { return this->L; }
+
+  /** Get the allocator statistics
+   * @return The counters of the allocator policy, or nullptr when the state uses the default allocator
+   */
+  const LuaAllocStats *AllocStats() const { return allocator ? &allocator->stats() : nullptr; }
+
+  /** Cache the compiled chunks of runString and runFile
+   * @param cache cache to use, may be shared between states, nullptr disables caching
+   */
+  void setChunkCache(std::shared_ptr<LuaChunkCache> cache) { chunkCache = std::move(cache); }
+  const std::shared_ptr<LuaChunkCache> &getChunkCache() const { return chunkCache; }
+
+  /** Record call metrics for the functions registered from now on
+   * @param metrics metrics to count into, may be shared between states, nullptr stops recording
+   */
+  void setMetrics(std::shared_ptr<LuaMetrics> metrics)
+  {
+    this->metrics = std::move(metrics);
+    if (!L)
+      return;
+    if (this->metrics)
+      this->metrics->attach(L);
+    else
+      LuaMetrics::detach(L);
+  }
+  const std::shared_ptr<LuaMetrics> &getMetrics() const { return metrics; }
+
+  /** Limit every runString, runFile and LuaChunk run of this script
+   * a script over budget is aborted with a lua error, see LuaBudget
+   * @param budget the limits, a budget without limits removes the hook
+   */
+  void setBudget(const LuaBudget &budget)
+  {
+    // the profiler chains to the budget hook, install it underneath
+    bool profiling = profiler && profiler->isRunning();
+    if (profiling)
+      profiler->stop();
+    meter.setBudget(budget);
+    if (L)
+      meter.attach(L);
+    if (profiling)
+      profiler->start();
+  }
+
+  /** Get the instructions and wall time used by this script so far */
+  const LuaBudgetUsage &BudgetUsage() const { return meter.usage(); }
+
+  /** Check if the last invocation was stopped by the budget */
+  bool BudgetExceeded() const { return meter.exceeded(); }
+
+  /** Start the sampling profiler, see LuaProfiler
+   * @param interval vm instructions between samples, 0 keeps the last interval
+   * @return The profiler, samples of earlier runs are kept
+   */
+  LuaProfiler &startProfiler(int interval = 0)
+  {
+    if (!profiler)
+      profiler = std::make_unique<LuaProfiler>(L);
+    profiler->start(interval);
+    return *profiler;
+  }
+
+  /** Stop the sampling profiler, the samples stay readable through Profiler() */
+  void stopProfiler()
+  {
+    if (profiler)
+      profiler->stop();
+  }
+
+  /** Get the profiler, nullptr if it was never started */
+  const LuaProfiler *Profiler() const { return profiler.get(); }
+
+  // runString
+  // Runs the lua code stored in the string
+  bool runString(const std::string &str)
+  {
+    LuaBudgetMeter::Scope budget(Metered());
+    // Attempt to execute the string as Lua code
+    int status = chunkCache ? chunkCache->load(this->L, str, str.c_str()) : luaL_loadstring(this->L, str.c_str());
+    if (status == 0)
+    {
+      LuaProfiler::Mark(this->L);
+      status = lua_pcall(this->L, 0, 0, 0);
+    }
+    if (status)
+    {
+      // the message names the chunk, the source itself is not repeated
+      LUA_LOG(LUA_LOG_ERROR, "failed to run string :: " << lua_tostring(this->L, -1));
+      return false;
+    }
+    return true;
+  }
+
+  /** Compile lua code once for repeated runs
+   * goes through the chunk cache when one is set
+   * @param source lua code
+   * @param chunkname name used in error messages, defaults to the source like luaL_loadstring
+   * @return The compiled chunk, check isValid() and error()
+   */
+  LuaChunk compile(const std::string &source, const std::string &chunkname = "")
+  {
+    const std::string &name = chunkname.empty() ? source : chunkname;
+    int status = chunkCache ? chunkCache->load(L, source, name.c_str())
+                            : luaL_loadbuffer(L, source.data(), source.size(), name.c_str());
+    return CompiledChunk(status, name);
+  }
+
+  /** Compile a lua file once for repeated runs
+   * @param filename file to compile
+   * @return The compiled chunk, check isValid() and error()
+   */
+  LuaChunk compileFile(const std::string &filename)
+  {
+    return CompiledChunk(loadFile(filename), "@" + filename);
+  }
+
+  // runFile
+  // Runs the lua code stored in the file
+  bool runFile(const std::string &filename)
+  {
+    LuaBudgetMeter::Scope budget(Metered());
+    int status = loadFile(filename);
+    if (status == 0)
+    {
+      LuaProfiler::Mark(this->L);
+      status = lua_pcall(this->L, 0, 0, 0);
+    }
+    if (status)
+    {
+      LUA_LOG(LUA_LOG_ERROR, "failed to load file :: '" << filename << "' " << lua_tostring(this->L, -1));
+      return false;
+    }
+    return true;
+  }
+
+  inline void clean()
+  {
+    int n = lua_gettop(L);
+    lua_pop(L, n);
+  }
+
+  // lua_gettostack
+  // Pushes the value at a dotted path onto the stack
+  bool lua_gettostack(const std::string &variableName)
+  {
+    level = 0;
+    lua_pushvalue(L, LUA_GLOBALSINDEX);
+    size_t start = 0;
+    for (;;)
+    {
+      size_t end = variableName.find('.', start);
+      size_t len = (end == std::string::npos ? variableName.size() : end) - start;
+      lua_pushlstring(L, variableName.data() + start, len);
+      lua_gettable(L, -2);
+      lua_replace(L, -2);
+      if (lua_isnil(L, -1))
+      {
+        printError(variableName, variableName.substr(start, len) + " is not defined");
+        return false;
+      }
+      if (end == std::string::npos)
+        return true;
+      if (!lua_istable(L, -1))
+      {
+        printError(variableName, variableName.substr(start, len) + " is not a table");
+        return false;
+      }
+      start = end + 1;
+      level++;
+    }
+  }
+
+  // lua_gettostack
+  // Pushes the value at a precompiled path onto the stack
+  bool lua_gettostack(const LuaPath &path)
+  {
+    size_t failed = path.resolve(L);
+    if (failed)
+    {
+      const char *reason = failed == path.segments().size() ? " is not defined" : " is not a table";
+      printError(path.str(), path.segments()[failed - 1] + reason);
+      return false;
+    }
+    return true;
+  }
+
+  // lua_gettostack
+  // Pushes the value held by a registry reference onto the stack
+  bool lua_gettostack(const LuaRef &ref)
+  {
+    ref.push(L);
+    if (lua_isnil(L, -1))
+    {
+      printError(PathName(ref), "is nil");
+      return false;
+    }
+    return true;
+  }
+
+  // lua_setfromstack
+  // Pops the value on top of the stack into a global
+  bool lua_setfromstack(const std::string &name)
+  {
+    lua_setglobal(L, name.c_str());
+    return true;
+  }
+
+  // lua_setfromstack
+  // Pops the value on top of the stack into a precompiled path
+  bool lua_setfromstack(const LuaPath &path)
+  {
+    size_t failed = path.assign(L);
+    if (failed)
+    {
+      printError(path.str(), path.segments()[failed - 1] + " is not a table");
+      return false;
+    }
+    return true;
+  }
+
+  template <typename T>
+  bool lua_is(lua_State *L, int index)
+  {
+    switch (lua_type(L, index))
+    {
+    case LUA_TSTRING:
+      return std::is_same<T, std::string>::value || std::is_same<T, std::string_view>::value;
+    case LUA_TBOOLEAN:
+      return std::is_same<T, bool>::value;
+    case LUA_TNUMBER:
+      return std::is_same<T, int>::value || std::is_same<T, double>::value;
+    case LUA_TTABLE:
+      return std::is_same<T, std::vector<std::string>>::value || std::is_same<T, std::vector<int>>::value || std::is_same<T, std::vector<double>>::value || std::is_same<T, std::vector<bool>>::value;
+    case LUA_TFUNCTION:
+      return std::is_same<T, lua_CFunction>::value;
+    case LUA_TUSERDATA:
+      return std::is_same<T, void *>::value;
+    default:
+      return false;
+    }
+  }
+
+  template <typename T>
+  T global_getdefault()
+  {
+    return T();
+  }
+
+  template <typename T>
+  T global_get(const std::string &variableName)
+  {
+    return GlobalGetAt<T>(variableName);
+  }
+
+  template <typename T>
+  T global_get(const LuaPath &path)
+  {
+    return GlobalGetAt<T>(path);
+  }
+
+  /** Pin the value at a global name or path in the registry
+   * @param name dotted name of the value
+   * @return A reference to the value, empty if it is not defined
+   */
+  LuaRef getRef(const std::string &name) { return GetRefAt(name); }
+  LuaRef getRef(const LuaPath &path) { return GetRefAt(path); }
+
+  std::vector<std::string> getTableKeys(const std::string &name) { return GetTableKeysAt(name); }
+  std::vector<std::string> getTableKeys(const LuaPath &path) { return GetTableKeysAt(path); }
+  std::vector<std::string> getTableKeys(const LuaRef &ref) { return GetTableKeysAt(ref); }
+
+  // GetList<std::string_view> does not copy the strings, the views are only
+  // valid while the table still holds them
+  template <typename T>
+  std::vector<T> GetList(const std::string &name) { return GetListAt<T>(name); }
+  template <typename T>
+  std::vector<T> GetList(const LuaPath &path) { return GetListAt<T>(path); }
+  template <typename T>
+  std::vector<T> GetList(const LuaRef &ref) { return GetListAt<T>(ref); }
+
+  /** Read the sequence part of a table into a caller provided buffer
+   * nothing is allocated, reading stops at the first value that is not a T
+   * @param out buffer to fill
+   * @param capacity number of elements `out` can hold
+   * @return The number of elements written
+   */
+  template <typename T>
+  size_t GetListInto(const std::string &name, T *out, size_t capacity) { return GetListIntoAt<T>(name, out, capacity); }
+  template <typename T>
+  size_t GetListInto(const LuaPath &path, T *out, size_t capacity) { return GetListIntoAt<T>(path, out, capacity); }
+  template <typename T>
+  size_t GetListInto(const LuaRef &ref, T *out, size_t capacity) { return GetListIntoAt<T>(ref, out, capacity); }
+
+  /** Read the sequence part of a table through an output iterator
+   * @param out iterator receiving values of type T
+   * @return The number of elements written
+   */
+  template <typename T, typename OutputIt>
+  size_t GetListInto(const std::string &name, OutputIt out) { return GetListIntoAt<T>(name, out, SIZE_MAX); }
+  template <typename T, typename OutputIt>
+  size_t GetListInto(const LuaPath &path, OutputIt out) { return GetListIntoAt<T>(path, out, SIZE_MAX); }
+  template <typename T, typename OutputIt>
+  size_t GetListInto(const LuaRef &ref, OutputIt out) { return GetListIntoAt<T>(ref, out, SIZE_MAX); }
+
+  template <typename T>
+  void SetList(const std::string &name, const std::vector<T> &list) { SetListAt(name, list.begin(), list.end()); }
+  template <typename T>
+  void SetList(const LuaPath &path, const std::vector<T> &list) { SetListAt(path, list.begin(), list.end()); }
+
+  /** Set a List from an iterator range, the table is created at its final size
+   * @param first iterator to the first element
+   * @param last iterator past the last element
+   */
+  template <typename It>
+  void SetList(const std::string &name, It first, It last) { SetListAt(name, first, last); }
+  template <typename It>
+  void SetList(const LuaPath &path, It first, It last) { SetListAt(path, first, last); }
+
+  /** Set a List from a contiguous buffer
+   * @param data first element
+   * @param count number of elements
+   */
+  template <typename T>
+  void SetList(const std::string &name, const T *data, size_t count) { SetListAt(name, data, data + count); }
+  template <typename T>
+  void SetList(const LuaPath &path, const T *data, size_t count) { SetListAt(path, data, data + count); }
+
+  // GetMap reads the entries whose key is a T and value is a U, others are
+  // skipped. With std::string_view keys or values nothing is copied, the
+  // views are only valid while the table still holds the strings.
+  template <typename T, typename U>
+  std::map<T, U> GetMap(const std::string &name) { return GetMapAt<T, U, std::map<T, U>>(name); }
+  template <typename T, typename U>
+  std::map<T, U> GetMap(const LuaPath &path) { return GetMapAt<T, U, std::map<T, U>>(path); }
+  template <typename T, typename U>
+  std::map<T, U> GetMap(const LuaRef &ref) { return GetMapAt<T, U, std::map<T, U>>(ref); }
+
+  /** Get a Map as a hash map, reserved for the size of the table */
+  template <typename T, typename U>
+  LuaUnorderedMap<T, U> GetUnorderedMap(const std::string &name) { return GetMapAt<T, U, LuaUnorderedMap<T, U>>(name); }
+  template <typename T, typename U>
+  LuaUnorderedMap<T, U> GetUnorderedMap(const LuaPath &path) { return GetMapAt<T, U, LuaUnorderedMap<T, U>>(path); }
+  template <typename T, typename U>
+  LuaUnorderedMap<T, U> GetUnorderedMap(const LuaRef &ref) { return GetMapAt<T, U, LuaUnorderedMap<T, U>>(ref); }
+
+  /** Get a Map as a sorted vector, see LuaFlatMap */
+  template <typename T, typename U>
+  LuaFlatMap<T, U> GetFlatMap(const std::string &name) { return GetMapAt<T, U, LuaFlatMap<T, U>>(name); }
+  template <typename T, typename U>
+  LuaFlatMap<T, U> GetFlatMap(const LuaPath &path) { return GetMapAt<T, U, LuaFlatMap<T, U>>(path); }
+  template <typename T, typename U>
+  LuaFlatMap<T, U> GetFlatMap(const LuaRef &ref) { return GetMapAt<T, U, LuaFlatMap<T, U>>(ref); }
+
+  /** Add the entries of a Map to a caller container
+   * maps get insert_or_assign(key, value), other associative containers
+   * emplace(key, value), sequences of pairs emplace_back(key, value) and a
+   * LuaFlatMap is sorted afterwards, so keys already in a map or LuaFlatMap
+   * take the value from the table. Containers with reserve() are reserved first.
+   * @return The number of entries read from the table
+   */
+  template <typename T, typename U, typename Container>
+  size_t GetMapInto(const std::string &name, Container &out) { return GetMapIntoAt<T, U>(name, out); }
+  template <typename T, typename U, typename Container>
+  size_t GetMapInto(const LuaPath &path, Container &out) { return GetMapIntoAt<T, U>(path, out); }
+  template <typename T, typename U, typename Container>
+  size_t GetMapInto(const LuaRef &ref, Container &out) { return GetMapIntoAt<T, U>(ref, out); }
+
+  template <typename T, typename U>
+  void SetMap(const std::string &name, const std::map<T, U> &map) { SetMapAt(name, map.begin(), map.end()); }
+  template <typename T, typename U>
+  void SetMap(const LuaPath &path, const std::map<T, U> &map) { SetMapAt(path, map.begin(), map.end()); }
+
+  /** Set a Map from an iterator range of key/value pairs
+   * works with any associative container or a vector of pairs
+   * @param first iterator to the first pair
+   * @param last iterator past the last pair
+   */
+  template <typename It>
+  void SetMap(const std::string &name, It first, It last) { SetMapAt(name, first, last); }
+  template <typename It>
+  void SetMap(const LuaPath &path, It first, It last) { SetMapAt(path, first, last); }
+
+  // Get the last error from lua
+  std::string GetError()
+  {
+    if (!lua_isstring(L, -1))
+      return {};
+ 
+    std::string err = lua_tostring(L, -1);
+    lua_pop(L, 1);
+    return err;
+  }
+
+private:
+  // PathName
+  // the name of an accessor location used in error messages
+  static const std::string &PathName(const std::string &name) { return name; }
+  static const std::string &PathName(const LuaPath &path) { return path.str(); }
+  static const std::string &PathName(const LuaRef &)
+  {
+    static const std::string name = "<LuaRef>";
+    return name;
+  }
+
+  template <typename Path>
+  LuaRef GetRefAt(const Path &path)
+  {
+    if (!L)
+    {
+      printError(PathName(path), "No State");
+      return LuaRef();
+    }
+    LuaRef ref;
+    if (lua_gettostack(path))
+      ref = LuaRef::fromTop(L);
+    clean();
+    return ref;
+  }
+
+  // CompiledChunk
+  // takes the result of a load into a LuaChunk
+  LuaChunk CompiledChunk(int status, const std::string &name)
+  {
+    if (status)
+    {
+      std::string error = lua_isstring(L, -1) ? lua_tostring(L, -1) : "";
+      lua_pop(L, 1);
+      LUA_LOG(LUA_LOG_ERROR, "failed to compile :: " << error);
+      return LuaChunk::failed(name, error);
+    }
+    return LuaChunk(LuaRef::fromTop(L), name, &meter);
+  }
+
+  // loadFile
+  // luaL_loadfile, through the chunk cache when one is set
+  int loadFile(const std::string &filename)
+  {
+    if (!chunkCache)
+      return luaL_loadfile(L, filename.c_str());
+    std::ifstream file(filename, std::ios::binary);
+    if (!file)
+    {
+      lua_pushfstring(L, "cannot open %s", filename.c_str());
+      return LUA_ERRFILE;
+    }
+    std::ostringstream content;
+    content << file.rdbuf();
+    std::string source = content.str();
+    // like luaL_loadfile, skip a leading '#' line but keep the line numbering
+    if (!source.empty() && source[0] == '#')
+      source.erase(0, source.find('\n') == std::string::npos ? source.size() : source.find('\n'));
+    return chunkCache->load(L, source, ("@" + filename).c_str());
+  }
+
+  template <typename T, typename Path>
+  T GlobalGetAt(const Path &path);
+
+  template <typename Path>
+  std::vector<std::string> GetTableKeysAt(const Path &path);
+
+  template <typename T, typename Path>
+  std::vector<T> GetListAt(const Path &path);
+
+  template <typename T, typename Path, typename OutputIt>
+  size_t GetListIntoAt(const Path &path, OutputIt out, size_t capacity);
+
+  // IsNumberKernel
+  // element types GetList reads straight from the number slot
+  template <typename T>
+  struct IsNumberKernel
+      : std::integral_constant<bool, std::is_same<T, double>::value || std::is_same<T, float>::value || std::is_same<T, int>::value>
+  {
+  };
+
+  template <typename T, typename OutputIt>
+  size_t ReadSequence(int table, OutputIt out, size_t count);
+
+  template <typename Path, typename It>
+  void SetListAt(const Path &path, It first, It last);
+
+  template <typename T, typename U, typename Map, typename Path>
+  Map GetMapAt(const Path &path);
+
+  template <typename T, typename U, typename Path, typename Container>
+  size_t GetMapIntoAt(const Path &path, Container &out);
+
+  // MapSlotIs
+  // check a key or value slot without converting it, number and string
+  // types only look at the type tag so number keys are never turned into
+  // strings in place under lua_next
+  template <typename T>
+  bool MapSlotIs(int index)
+  {
+    if constexpr (std::is_same<T, bool>::value)
+      return lua_type(L, index) == LUA_TBOOLEAN;
+    else if constexpr (std::is_arithmetic<T>::value)
+      return lua_type(L, index) == LUA_TNUMBER;
+    else if constexpr (std::is_same<T, std::string>::value || std::is_same<T, std::string_view>::value)
+      return lua_type(L, index) == LUA_TSTRING;
+    else
+      return lua_is<T>(L, index);
+  }
+
+  template <typename T>
+  T MapSlot(int index)
+  {
+    if constexpr (std::is_same<T, bool>::value)
+      return lua_toboolean(L, index) != 0;
+    else if constexpr (std::is_integral<T>::value)
+      return static_cast<T>(lua_tointeger(L, index));
+    else if constexpr (std::is_floating_point<T>::value)
+      return static_cast<T>(lua_tonumber(L, index));
+    else
+      return lua_get<T>(L, index);
+  }
+
+  template <typename T, typename U, typename Container>
+  size_t ReadMap(int table, Container &out);
+
+  template <typename Path, typename It>
+  void SetMapAt(const Path &path, It first, It last);
+
+  lua_State *L;
+  std::string filename;
+  int level;
+  std::unique_ptr<LuaAllocator> allocator;
+  std::shared_ptr<LuaChunkCache> chunkCache;
+  std::shared_ptr<LuaMetrics> metrics;
+  LuaBudgetMeter meter;
+  std::unique_ptr<LuaProfiler> profiler;
+
+  // the meter when a budget is set
+  LuaBudgetMeter *Metered() { return meter.budget().limited() ? &meter : nullptr; }
+};
+
+LuaScript::LuaScript(const std::string &filename)
+{
+  L = luaL_newstate();
+  if (luaL_loadfile(L, filename.c_str()) || lua_pcall(L, 0, 0, 0))
+  {
+    LUA_LOG(LUA_LOG_ERROR, "failed to load (" << filename << ")");
+    L = 0;
+    return;
+  }
+
+  if (L)
+  {
+    LuaSetMainThread(L);
+    luaL_openlibs(L);
+  }
+}
+
+LuaScript::LuaScript(std::unique_ptr<LuaAllocator> allocator) : allocator(std::move(allocator))
+{
+  L = lua_newstate(this->allocator->function(), this->allocator->userdata());
+  if (!L)
+  {
+    LUA_LOG(LUA_LOG_ERROR, "failed to create lua state");
+    return;
+  }
+  lua_atpanic(L, [](lua_State *L) -> int {
+    LUA_LOG(LUA_LOG_ERROR, "PANIC: unprotected error in call to Lua API (" << lua_tostring(L, -1) << ")");
+    return 0;
+  });
+  LuaSetMainThread(L);
+  luaL_openlibs(L);
+}
+
+LuaScript::LuaScript(lua_State *L)
+{
+  this->L = L;
+  LuaSetMainThread(L);
+  luaL_openlibs(L);
+}
+
+LuaScript::~LuaScript()
+{
+  if (L)
+  {
+    profiler.reset();
+    meter.detach();
+    lua_close(L);
+  }
+}
+
+void LuaScript::printError(const std::string &variableName, const std::string &reason)
+{
+  LUA_LOG(LUA_LOG_ERROR, "can't get [" << variableName << "] > " << reason);
+}
+
+// template getTableKeys
+// Gets the string and number keys of a table, in traversal order
+template <typename Path>
+std::vector<std::string> LuaScript::GetTableKeysAt(const Path &path)
+{
+  const std::string &name = PathName(path);
+  std::vector<std::string> keys;
+  if (!L)
+  {
+    printError(name, "No State");
+    return keys;
+  }
+
+  if (lua_gettostack(path))
+  {
+    if (lua_istable(L, -1))
+    {
+      for (LuaTableEntry entry : LuaTableRange(L, -1))
+      {
+        int type = entry.keyType();
+        if (type == LUA_TSTRING || type == LUA_TNUMBER)
+          keys.push_back(entry.key<std::string>());
+      }
+    }
+    else
+    {
+      printError(name, "is not a table");
+    }
+  }
+  clean();
+  return keys;
+}
+
+// template GlobalGetAt
+// Gets a value of type T at a global name or path
+template <typename T, typename Path>
+T LuaScript::GlobalGetAt(const Path &path)
+{
+  if (!L)
+  {
+    printError(PathName(path), "Script is not loaded");
+    return global_getdefault<T>();
+  }
+
+  LUA_LOG_STACK(L);
+
+  T result;
+  if (lua_gettostack(path))
+  { // variable succesfully on top of stack
+    result = lua_get<T>(L, -1);
+  }
+  else
+  {
+    result = global_getdefault<T>();
+  }
+
+  clean();
+  return result;
+}
+
+// template GetList
+// Gets a List of values of type T in the lua state
+template <typename T, typename Path>
+std::vector<T> LuaScript::GetListAt(const Path &path)
+{
+  const std::string &name = PathName(path);
+  std::vector<T> result;
+  if (!L)
+  {
+    printError(name, "No State");
+    return result;
+  }
+
+  if (lua_gettostack(path))
+  { // variable succesfully on top of stack
+    if (lua_istable(L, -1))
+    {
+      int table = lua_gettop(L);
+      size_t count = lua_objlen(L, table);
+      if (count > 0)
+      { // sequence, read t[1..count] in index order
+        if constexpr (IsNumberKernel<T>::value)
+        {
+          result.resize(count);
+          result.resize(ReadSequence<T>(table, result.data(), count));
+        }
+        else
+        {
+          result.reserve(count);
+          ReadSequence<T>(table, std::back_inserter(result), count);
+        }
+      }
+      else
+      {                 // no array part, fall back to hash order
+        lua_pushnil(L); // nil key on top of stack
+        while (lua_next(L, table) != 0)
+        { // key and value on top of stack
+          if (!lua_is<T>(L, -1))
+          {
+            // skip invalid value
+            break;
+          }
+          result.push_back(lua_get<T>(L, -1));
+          lua_pop(L, 1); // remove value, keep key for next iteration
+        }
+      }
+    }
+    else
+    {
+      printError(name, "is not a table");
+    }
+  }
+  clean();
+  return result;
+}
+
+// template GetListInto
+// Reads the sequence part of a table into a caller provided buffer
+template <typename T, typename Path, typename OutputIt>
+size_t LuaScript::GetListIntoAt(const Path &path, OutputIt out, size_t capacity)
+{
+  const std::string &name = PathName(path);
+  size_t read = 0;
+  if (!L)
+  {
+    printError(name, "No State");
+    return read;
+  }
+
+  if (lua_gettostack(path))
+  {
+    if (lua_istable(L, -1))
+    {
+      int table = lua_gettop(L);
+      read = ReadSequence<T>(table, out, std::min(lua_objlen(L, table), capacity));
+    }
+    else
+    {
+      printError(name, "is not a table");
+    }
+  }
+  clean();
+  return read;
+}
+
+// template ReadSequence
+// Reads t[1..count] of the table at `table` into out, stops at the first
+// value that is not a T and returns the number of values read
+template <typename T, typename OutputIt>
+size_t LuaScript::ReadSequence(int table, OutputIt out, size_t count)
+{
+  for (size_t i = 1; i <= count; i++)
+  {
+    lua_rawgeti(L, table, static_cast<int>(i));
+    if constexpr (IsNumberKernel<T>::value)
+    { // numbers only need a type tag check, no lua_is<T> switch
+      if (lua_type(L, -1) != LUA_TNUMBER)
+      {
+        lua_pop(L, 1);
+        return i - 1;
+      }
+      if constexpr (std::is_integral<T>::value)
+        *out = static_cast<T>(lua_tointeger(L, -1));
+      else
+        *out = static_cast<T>(lua_tonumber(L, -1));
+    }
+    else
+    {
+      if (!lua_is<T>(L, -1))
+      {
+        lua_pop(L, 1);
+        return i - 1;
+      }
+      *out = lua_get<T>(L, -1);
+    }
+    ++out;
+    lua_pop(L, 1);
+  }
+  return count;
+}
+
+// template SetList
+// Sets a List of values in the lua state from an iterator range
+template <typename Path, typename It>
+void LuaScript::SetListAt(const Path &path, It first, It last)
+{
+  using T = LuaArg<typename std::iterator_traits<It>::value_type>;
+  if (!L)
+  {
+    printError(PathName(path), "No State");
+    return;
+  }
+
+  lua_createtable(L, static_cast<int>(std::distance(first, last)), 0);
+  int i = 1;
+  for (; first != last; ++first)
+  {
+    LuaStack<T>::push(L, *first);
+    lua_rawseti(L, -2, i++);
+  }
+  lua_setfromstack(path);
+}
+
+// template GetMap
+// Gets a Map as any container GetMapInto can fill
+template <typename T, typename U, typename Map, typename Path>
+Map LuaScript::GetMapAt(const Path &path)
+{
+  Map result;
+  GetMapIntoAt<T, U>(path, result);
+  return result;
+}
+
+// template GetMapInto
+// Adds the entries of a Map to a container
+template <typename T, typename U, typename Path, typename Container>
+size_t LuaScript::GetMapIntoAt(const Path &path, Container &out)
+{
+  const std::string &name = PathName(path);
+  size_t read = 0;
+  if (!L)
+  {
+    printError(name, "No State");
+    return read;
+  }
+
+  if (lua_gettostack(path))
+  {
+    if (lua_istable(L, -1))
+      read = ReadMap<T, U>(lua_gettop(L), out);
+    else
+      printError(name, "is not a table");
+  }
+  clean();
+  if constexpr (std::is_same<Container, LuaFlatMap<T, U>>::value)
+    out.sort();
+  return read;
+}
+
+// LuaMapReserve
+// containers GetMapInto reserves before filling
+template <typename C, typename = void>
+struct LuaMapReserve : std::false_type
+{
+};
+
+template <typename C>
+struct LuaMapReserve<C, std::void_t<decltype(std::declval<C &>().reserve(size_t()))>> : std::true_type
+{
+};
+
+// LuaMapEmplace
+// containers filled with emplace(key, value), the rest with emplace_back
+template <typename C, typename = void>
+struct LuaMapEmplace : std::false_type
+{
+};
+
+template <typename C>
+struct LuaMapEmplace<C, std::void_t<typename C::key_type>> : std::true_type
+{
+};
+
+// LuaMapAssign
+// unique-key maps, filled with insert_or_assign(key, value) so existing keys are overwritten
+template <typename C, typename = void>
+struct LuaMapAssign : std::false_type
+{
+};
+
+template <typename C>
+struct LuaMapAssign<C, std::void_t<decltype(std::declval<C &>().insert_or_assign(std::declval<typename C::key_type>(),
+                                                                               std::declval<typename C::mapped_type>()))>>
+    : std::true_type
+{
+};
+
+template <typename T, typename U, typename Container>
+size_t LuaScript::ReadMap(int table, Container &out)
+{
+  if constexpr (LuaMapReserve<Container>::value)
+  {
+    // lua 5.1 has no call for the size of a table's hash part, counting the
+    // keys is much cheaper than the rehashes or reallocations it saves
+    size_t count = 0;
+    for (lua_pushnil(L); lua_next(L, table); lua_pop(L, 1))
+      count++;
+    out.reserve(out.size() + count);
+  }
+
+  size_t read = 0;
+  for (lua_pushnil(L); lua_next(L, table); lua_pop(L, 1))
+  { // key at -2, value at -1
+    if (!MapSlotIs<T>(-2) || !MapSlotIs<U>(-1))
+      continue;
+    if constexpr (LuaMapAssign<Container>::value)
+      out.insert_or_assign(MapSlot<T>(-2), MapSlot<U>(-1));
+    else if constexpr (LuaMapEmplace<Container>::value)
+      out.emplace(MapSlot<T>(-2), MapSlot<U>(-1));
+    else
+      out.emplace_back(MapSlot<T>(-2), MapSlot<U>(-1));
+    read++;
+  }
+  return read;
+}
+
+template <typename Path, typename It>
+void LuaScript::SetMapAt(const Path &path, It first, It last)
+{
+  using Pair = typename std::iterator_traits<It>::value_type;
+  using T = LuaArg<typename Pair::first_type>;
+  using U = LuaArg<typename Pair::second_type>;
+  if (!L)
+  {
+    printError(PathName(path), "No State");
+    return;
+  }
+
+  lua_createtable(L, 0, static_cast<int>(std::distance(first, last)));
+  for (; first != last; ++first)
+  {
+    LuaStack<T>::push(L, first->first);
+    LuaStack<U>::push(L, first->second);
+    lua_rawset(L, -3);
+  }
+  lua_setfromstack(path);
+}
+
+// ─── LuaTable ────────────────────────────────────────────────────────────────
 
 // class LuaTable
-// {
-//   LuaTable(LuaScript *luaScript, const std::string &name);
+// A proxy to a lua table held by a registry reference. Reads and writes go
+// straight to the table with raw accesses, nothing is copied into C++
+// containers. The lua_State must outlive the LuaTable. On a LuaTable that
+// holds no table reads give the fallback, writes are ignored and the size
+// is 0, so a chain through a missing field is safe.
+class LuaTable
+{
+public:
+  // the stored form of a key, string literals become const char *
+  template <typename K>
+  using Key = typename std::decay<const K &>::type;
+
+  template <typename K>
+  class Proxy;
+  class iterator;
+
+  LuaTable() = default;
+  LuaTable(LuaScript *luaScript, const std::string &name);
+  LuaTable(LuaScript *luaScript, const LuaPath &path);
+  explicit LuaTable(LuaRef ref) : ref(std::move(ref)) {}
+  LuaTable(lua_State *L, int index) : ref(L, index) {}
+
+  /** Create a new empty table
+   * @param narr number of array slots to preallocate
+   * @param nrec number of hash slots to preallocate
+   */
+  static LuaTable create(lua_State *L, int narr = 0, int nrec = 0)
+  {
+    lua_createtable(L, narr, nrec);
+    return LuaTable(LuaRef::fromTop(L));
+  }
+
+  bool isValid() const { return ref.type() == LUA_TTABLE; }
+
+  std::vector<std::string> getKeys() const;
+
+  /** Get t[key] as T
+   * @return The value, or T() if it is nil or not a T
+   */
+  template <typename T, typename K>
+  T get(const K &key) const;
+
+  /** Get t[key] as T, or `fallback` if it is nil or not a T */
+  template <typename T, typename K>
+  T get(const K &key, const T &fallback) const;
+
+  /** Set t[key] = value */
+  template <typename K, typename V>
+  void set(const K &key, const V &value) const;
+
+  /** Access t[key], chains for nested tables: t["window"]["width"].get<int>() */
+  template <typename K>
+  Proxy<Key<K>> operator[](const K &key) const;
+
+  /** Get the length of the sequence part (#t) */
+  size_t size() const
+  {
+    lua_State *L = ref.state();
+    if (!L)
+      return 0;
+    ref.push();
+    size_t n = lua_istable(L, -1) ? lua_objlen(L, -1) : 0;
+    lua_pop(L, 1);
+    return n;
+  }
+
+  iterator begin() const;
+  iterator end() const;
+
+  const LuaRef &reference() const { return ref; }
+  lua_State *state() const { return ref.state(); }
+
+private:
+  // pushes the key, integer keys go through lua_rawgeti/lua_rawseti instead
+  template <typename K>
+  static void pushKey(lua_State *L, const K &key)
+  {
+    LuaStack<Key<K>>::push(L, key);
+  }
+
+  // pushes the table, false with nothing pushed if the ref holds no table
+  bool pushTable() const
+  {
+    lua_State *L = ref.state();
+    if (!L)
+      return false;
+    ref.push();
+    if (lua_istable(L, -1))
+      return true;
+    lua_pop(L, 1);
+    return false;
+  }
+
+  // leaves t[key] on top of the stack, false with nothing pushed if the ref holds no table
+  template <typename K>
+  bool pushField(const K &key) const
+  {
+    lua_State *L = ref.state();
+    if (!pushTable())
+      return false;
+    if constexpr (std::is_integral<K>::value && !std::is_same<K, bool>::value)
+    {
+      lua_rawgeti(L, -1, static_cast<int>(key));
+    }
+    else
+    {
+      pushKey(L, key);
+      lua_rawget(L, -2);
+    }
+    lua_replace(L, -2);
+    return true;
+  }
+
+  LuaRef ref;
+};
+
+// class LuaTable::Proxy
+// t[key] of a LuaTable, resolved only when read or assigned. Proxies are
+// meant to be used within one expression and cannot be copied.
+template <typename K>
+class LuaTable::Proxy
+{
+public:
+  Proxy(const LuaTable &parent, const K &key) : parent(&parent), key(key) {}
+  Proxy(LuaTable &&owned, const K &key) : owned(std::move(owned)), parent(&this->owned), key(key) {}
+  Proxy(const Proxy &) = delete;
+  Proxy &operator=(const Proxy &) = delete;
+
+  template <typename T>
+  T get() const { return parent->get<T>(key); }
+
+  template <typename T>
+  T get(const T &fallback) const { return parent->get<T>(key, fallback); }
+
+  template <typename V>
+  const Proxy &operator=(const V &value) const
+  {
+    parent->set(key, value);
+    return *this;
+  }
+
+  int type() const
+  {
+    lua_State *L = parent->state();
+    if (!parent->pushField(key))
+      return LUA_TNIL;
+    int t = lua_type(L, -1);
+    lua_pop(L, 1);
+    return t;
+  }
+
+  bool isNil() const { return type() == LUA_TNIL; }
+
+  /** Get the value as a LuaTable, one holding no table if it is missing */
+  LuaTable table() const
+  {
+    if (!parent->pushField(key))
+      return LuaTable();
+    return LuaTable(LuaRef::fromTop(parent->state()));
+  }
+
+  template <typename K2>
+  Proxy<Key<K2>> operator[](const K2 &subkey) const
+  {
+    return Proxy<Key<K2>>(table(), subkey);
+  }
+
+private:
+  LuaTable owned;
+  const LuaTable *parent;
+  K key;
+};
+
+// class LuaTable::iterator
+// walks the table with LuaTableRange, the table is pushed for the walk and
+// popped when the iterator is destroyed
+class LuaTable::iterator
+{
+public:
+  iterator() = default;
+  explicit iterator(const LuaRef &ref) : L(ref.state())
+  {
+    top = lua_gettop(L);
+    ref.push();
+    it.emplace(L, top + 1);
+  }
+  iterator(const iterator &) = delete;
+  iterator(iterator &&other) noexcept : L(other.L), top(other.top), it(std::move(other.it))
+  {
+    other.L = nullptr;
+    other.it.reset();
+  }
+  ~iterator()
+  {
+    if (L)
+    {
+      it.reset();
+      lua_settop(L, top);
+    }
+  }
+
+  iterator &operator++()
+  {
+    ++*it;
+    return *this;
+  }
+  LuaTableEntry operator*() const { return **it; }
+  bool operator!=(const iterator &other) const { return active() != other.active(); }
+  bool operator==(const iterator &other) const { return active() == other.active(); }
+
+private:
+  bool active() const { return it && *it != LuaTableRange::iterator(); }
+
+  lua_State *L = nullptr;
+  int top = 0;
+  std::optional<LuaTableRange::iterator> it;
+};
+
+LuaTable::LuaTable(LuaScript *luaScript, const std::string &tableName) : ref(luaScript->getRef(tableName))
+{
+}
+
+LuaTable::LuaTable(LuaScript *luaScript, const LuaPath &path) : ref(luaScript->getRef(path))
+{
+}
+
+std::vector<std::string> LuaTable::getKeys() const
+{
+  std::vector<std::string> keys;
+  for (LuaTableEntry entry : *this)
+  {
+    int type = entry.keyType();
+    if (type == LUA_TSTRING || type == LUA_TNUMBER)
+      keys.push_back(entry.key<std::string>());
+  }
+  return keys;
+}
+
+template <typename T, typename K>
+T LuaTable::get(const K &key) const
+{
+  return get<T>(key, T());
+}
+
+template <typename T, typename K>
+T LuaTable::get(const K &key, const T &fallback) const
+{
+  lua_State *L = ref.state();
+  if (!pushField(key))
+    return fallback;
+  T value = fallback;
+  if (!lua_isnil(L, -1) && LuaReturnTo(L, lua_gettop(L), value) != 0)
+  {
+    LUA_LOG(LUA_LOG_WARN, "LuaTable: " << lua_tostring(L, -1));
+    lua_pop(L, 1);
+    value = fallback;
+  }
+  lua_pop(L, 1);
+  return value;
+}
+
+template <typename K, typename V>
+void LuaTable::set(const K &key, const V &value) const
+{
+  lua_State *L = ref.state();
+  if (!pushTable())
+    return;
+  if constexpr (std::is_integral<K>::value && !std::is_same<K, bool>::value)
+  {
+    LuaStack<Key<V>>::push(L, value);
+    lua_rawseti(L, -2, static_cast<int>(key));
+  }
+  else
+  {
+    pushKey(L, key);
+    LuaStack<Key<V>>::push(L, value);
+    lua_rawset(L, -3);
+  }
+  lua_pop(L, 1);
+}
+
+template <typename K>
+LuaTable::Proxy<LuaTable::Key<K>> LuaTable::operator[](const K &key) const
+{
+  return Proxy<Key<K>>(*this, key);
+}
 
-//   bool isValid() const;
+LuaTable::iterator LuaTable::begin() const
+{
+  return isValid() ? iterator(ref) : iterator();
+}
 
-//   std::vector<std::string> getKeys() const;
+LuaTable::iterator LuaTable::end() const
+{
+  return iterator();
+}
 
-//   template <typename T>
-//   T get(const std::string &key) const;
-// };
+//------------------------------------------------------------------------------
+/**
+  LuaStack specialization for `LuaTable`.
+  */
+template <>
+struct LuaStack<LuaTable>
+{
+  static inline void push(lua_State *L, const LuaTable &table)
+  {
+    table.reference().push(L);
+  }
 
-// LuaTable::LuaTable(LuaScript *luaScript, const std::string &tableName)
-// {
-//   this->luaScript = luaScript;
-//   this->name = tableName;
-// }
+  static inline LuaTable get(lua_State *L, int index)
+  {
+    luaL_checktype(L, index, LUA_TTABLE);
+    return LuaTable(L, index);
+  }
+};
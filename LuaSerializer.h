@@ -0,0 +1,591 @@
+// Copyright (C) 2023 Theros < MisModding | SvalTek >
+//
+// This file is part of LuaBinder.
+//
+// LuaBinder is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LuaBinder is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LuaBinder.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+#include "Lua.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// ─── LuaSerializer ───────────────────────────────────────────────────────────
+
+// class LuaSerializer
+// Binary serialization of lua values: nil, booleans, numbers, strings and
+// tables of those, nested to any shape.
+//
+//   LuaSerializer serializer;
+//   std::string blob;
+//   lua_getglobal(L, "state");
+//   serializer.save(L, -1, blob);   // checkpoint
+//   ...
+//   serializer.load(other, blob);   // the table is on top of other's stack
+//
+// Format: "LB" and a version byte, then one value. Every value starts with a
+// tag byte. Integral numbers are zigzag varints and other numbers are 8-byte
+// little-endian doubles. A string of 3 or more bytes is written once and
+// then referenced by index. A table holds its array and hash sizes, so load
+// presizes it with lua_createtable. A table reached a second time is written
+// as a reference, which keeps cycles and shared subtables intact.
+// Functions, userdata and threads are an error unless skipUnsupported is
+// set, in which case table entries holding them are left out.
+class LuaSerializer
+{
+public:
+  struct Options
+  {
+    int maxDepth = 200;           // nested tables, guards the C stack
+    bool skipUnsupported = false; // drop entries that can't be serialized instead of failing
+  };
+
+  // receives the output in blocks, returning false stops the save
+  using Writer = std::function<bool(const char *data, size_t size)>;
+
+  LuaSerializer() = default;
+  explicit LuaSerializer(Options options) : options(options) {}
+
+  /** Serialize the value at index, appending to out
+   * @return false on error, see error(), out is left as it was
+   */
+  bool save(lua_State *L, int index, std::string &out)
+  {
+    size_t size = out.size();
+    Output output;
+    output.str = &out;
+    if (Save(L, index, output))
+      return true;
+    out.resize(size);
+    return false;
+  }
+
+  /** Serialize the value at index, streaming it to writer in blocks */
+  bool save(lua_State *L, int index, const Writer &writer)
+  {
+    std::string block;
+    Output output;
+    output.str = &block;
+    output.writer = &writer;
+    return Save(L, index, output) && output.flush();
+  }
+
+  /** Serialize the value at index into a caller buffer
+   * @return The number of bytes written, 0 on error or if the buffer is too small
+   */
+  size_t save(lua_State *L, int index, char *buffer, size_t capacity)
+  {
+    Output output;
+    output.buffer = buffer;
+    output.capacity = capacity;
+    return Save(L, index, output) ? output.length : 0;
+  }
+
+  /** Deserialize a value and push it
+   * @return false on malformed input with nothing pushed, see error()
+   */
+  bool load(lua_State *L, const char *data, size_t size)
+  {
+    int top = lua_gettop(L);
+    lastError.clear();
+    input = {data, data + size};
+    loadedStrings.clear();
+    loadedTables = 0;
+    if (size < 3 || data[0] != 'L' || data[1] != 'B')
+      return Fail(L, top, "not a LuaSerializer blob");
+    if (static_cast<uint8_t>(data[2]) != Version)
+      return Fail(L, top, "unsupported version");
+    input.first += 3;
+    lua_newtable(L); // tables by id, for references
+    if (!Read(L, top + 1, 0))
+      return Fail(L, top, lastError.empty() ? "malformed input" : lastError);
+    if (input.first != input.second)
+      return Fail(L, top, "trailing bytes after value");
+    lua_remove(L, top + 1);
+    return true;
+  }
+
+  bool load(lua_State *L, std::string_view data) { return load(L, data.data(), data.size()); }
+
+  /** Get the error of the last save or load, empty on success */
+  const std::string &error() const { return lastError; }
+
+  /** Add a global table with encode(value) -> string and decode(string) -> value
+   * decode returns nil and the error message on malformed input
+   */
+  static void Register(lua_State *L, const char *name)
+  {
+    lua_newtable(L);
+    lua_pushcfunction(L, &Encode);
+    lua_setfield(L, -2, "encode");
+    lua_pushcfunction(L, &Decode);
+    lua_setfield(L, -2, "decode");
+    lua_setglobal(L, name);
+  }
+
+private:
+  static constexpr uint8_t Version = 1;
+  static constexpr size_t BlockSize = 64 * 1024;
+  static constexpr size_t MinSharedString = 3;
+
+  enum Tag : uint8_t
+  {
+    TagNil,
+    TagFalse,
+    TagTrue,
+    TagInteger, // zigzag varint
+    TagDouble,  // 8 bytes little endian
+    TagString,  // varint length, bytes
+    TagStringRef,
+    TagTable, // varint array size, varint hash size, array values, key/value pairs
+    TagTableRef,
+  };
+
+  // PointerIds
+  // ids of the strings and tables seen by a save, an open addressing table
+  // that keeps its capacity between saves
+  class PointerIds
+  {
+  public:
+    /** Get the id of p, giving it the next id if it is new
+     * @return The id and true if p was inserted
+     */
+    std::pair<uint32_t, bool> emplace(const void *p)
+    {
+      if ((count + 1) * 2 > slots.size())
+        Grow();
+      size_t mask = slots.size() - 1;
+      for (size_t i = Hash(p) & mask;; i = (i + 1) & mask)
+      {
+        if (slots[i].first == p)
+          return {slots[i].second, false};
+        if (!slots[i].first)
+        {
+          slots[i] = {p, count};
+          return {count++, true};
+        }
+      }
+    }
+
+    void clear()
+    {
+      if (count)
+        std::fill(slots.begin(), slots.end(), std::pair<const void *, uint32_t>(nullptr, 0));
+      count = 0;
+    }
+
+  private:
+    static size_t Hash(const void *p)
+    {
+      uint64_t h = reinterpret_cast<uintptr_t>(p);
+      h ^= h >> 33;
+      h *= 0xff51afd7ed558ccdull;
+      h ^= h >> 33;
+      return static_cast<size_t>(h);
+    }
+
+    void Grow()
+    {
+      std::vector<std::pair<const void *, uint32_t>> old(slots.empty() ? 64 : slots.size() * 2);
+      old.swap(slots);
+      size_t mask = slots.size() - 1;
+      for (const auto &entry : old)
+      {
+        if (!entry.first)
+          continue;
+        size_t i = Hash(entry.first) & mask;
+        while (slots[i].first)
+          i = (i + 1) & mask;
+        slots[i] = entry;
+      }
+    }
+
+    std::vector<std::pair<const void *, uint32_t>> slots;
+    uint32_t count = 0;
+  };
+
+  // Output
+  // appends to a string, or to a fixed buffer when buffer is set, and hands
+  // full blocks of the string to writer when one is set
+  struct Output
+  {
+    std::string *str = nullptr;
+    char *buffer = nullptr;
+    size_t capacity = 0;
+    size_t length = 0;
+    bool overflow = false;
+    const Writer *writer = nullptr;
+
+    void append(const void *p, size_t n)
+    {
+      if (buffer)
+      {
+        if (n > capacity - length)
+        {
+          overflow = true;
+          return;
+        }
+        std::memcpy(buffer + length, p, n);
+        length += n;
+      }
+      else
+        str->append(static_cast<const char *>(p), n);
+    }
+
+    void byte(uint8_t b) { append(&b, 1); }
+
+    void varint(uint64_t v)
+    {
+      uint8_t bytes[10];
+      size_t n = 0;
+      while (v >= 0x80)
+      {
+        bytes[n++] = static_cast<uint8_t>(v | 0x80);
+        v >>= 7;
+      }
+      bytes[n++] = static_cast<uint8_t>(v);
+      append(bytes, n);
+    }
+
+    bool flush()
+    {
+      if (!writer || str->empty())
+        return true;
+      bool ok = (*writer)(str->data(), str->size());
+      str->clear();
+      return ok;
+    }
+
+    // streams a full block, false when the writer gave up or the buffer is full
+    bool poll() { return !overflow && (!writer || str->size() < BlockSize || flush()); }
+  };
+
+  bool Save(lua_State *L, int index, Output &output)
+  {
+    lastError.clear();
+    savedStrings.clear();
+    savedTables.clear();
+    int top = lua_gettop(L);
+    index = index < 0 && index > LUA_REGISTRYINDEX ? top + index + 1 : index;
+    output.append("LB", 2);
+    output.byte(Version);
+    bool ok = Write(L, index, output, 0);
+    lua_settop(L, top);
+    if (output.overflow)
+    {
+      lastError = "buffer too small";
+      ok = false;
+    }
+    return ok;
+  }
+
+  static bool Supported(int type) { return type <= LUA_TTABLE && type != LUA_TLIGHTUSERDATA; }
+
+  // writes the value at index (an absolute index)
+  bool Write(lua_State *L, int index, Output &output, int depth)
+  {
+    switch (lua_type(L, index))
+    {
+    case LUA_TNIL:
+    case LUA_TNONE:
+      output.byte(TagNil);
+      return true;
+    case LUA_TBOOLEAN:
+      output.byte(lua_toboolean(L, index) ? TagTrue : TagFalse);
+      return true;
+    case LUA_TNUMBER:
+      WriteNumber(lua_tonumber(L, index), output);
+      return true;
+    case LUA_TSTRING:
+    {
+      size_t len;
+      const char *s = lua_tolstring(L, index, &len);
+      if (len >= MinSharedString)
+      {
+        auto seen = savedStrings.emplace(s);
+        if (!seen.second)
+        {
+          output.byte(TagStringRef);
+          output.varint(seen.first);
+          return true;
+        }
+      }
+      output.byte(TagString);
+      output.varint(len);
+      output.append(s, len);
+      return true;
+    }
+    case LUA_TTABLE:
+      return WriteTable(L, index, output, depth);
+    default:
+      lastError = std::string("can't serialize a ") + luaL_typename(L, index);
+      return false;
+    }
+  }
+
+  static void WriteNumber(lua_Number n, Output &output)
+  {
+    if (n >= -9.2e18 && n <= 9.2e18 && static_cast<lua_Number>(static_cast<int64_t>(n)) == n && !(n == 0 && std::signbit(n)))
+    {
+      int64_t i = static_cast<int64_t>(n);
+      output.byte(TagInteger);
+      output.varint((static_cast<uint64_t>(i) << 1) ^ static_cast<uint64_t>(i >> 63));
+      return;
+    }
+    double d = static_cast<double>(n);
+    uint64_t bits;
+    std::memcpy(&bits, &d, sizeof(bits));
+    uint8_t bytes[9];
+    bytes[0] = TagDouble;
+    for (int i = 0; i < 8; i++)
+      bytes[i + 1] = static_cast<uint8_t>(bits >> (8 * i));
+    output.append(bytes, sizeof(bytes));
+  }
+
+  bool WriteTable(lua_State *L, int index, Output &output, int depth)
+  {
+    auto seen = savedTables.emplace(lua_topointer(L, index));
+    if (!seen.second)
+    {
+      output.byte(TagTableRef);
+      output.varint(seen.first);
+      return true;
+    }
+    if (depth >= options.maxDepth)
+    {
+      lastError = "tables nested too deep";
+      return false;
+    }
+    if (!lua_checkstack(L, 4))
+    {
+      lastError = "stack overflow";
+      return false;
+    }
+
+    // the array part is 1..n, holes inside it are written as nil
+    size_t n = lua_objlen(L, index);
+    size_t pairs = 0;
+    for (lua_pushnil(L); lua_next(L, index); lua_pop(L, 1))
+    {
+      if (!Supported(lua_type(L, -1)) || !Supported(lua_type(L, -2)))
+      {
+        if (options.skipUnsupported)
+          continue;
+        lastError = std::string("can't serialize a ") + luaL_typename(L, Supported(lua_type(L, -1)) ? -2 : -1);
+        return false;
+      }
+      if (!ArrayKey(L, -2, n))
+        pairs++;
+    }
+
+    output.byte(TagTable);
+    output.varint(n);
+    output.varint(pairs);
+    for (size_t i = 1; i <= n; i++)
+    {
+      lua_rawgeti(L, index, static_cast<int>(i));
+      bool ok = Supported(lua_type(L, -1)) ? Write(L, lua_gettop(L), output, depth + 1) : (output.byte(TagNil), true);
+      lua_pop(L, 1);
+      if (!ok || !output.poll())
+        return Stopped(ok);
+    }
+    if (pairs == 0)
+      return true;
+    for (lua_pushnil(L); lua_next(L, index); lua_pop(L, 1))
+    {
+      if (!Supported(lua_type(L, -1)) || !Supported(lua_type(L, -2)) || ArrayKey(L, -2, n))
+        continue;
+      int top = lua_gettop(L);
+      if (!Write(L, top - 1, output, depth + 1) || !Write(L, top, output, depth + 1))
+        return false;
+      if (!output.poll())
+        return Stopped(true);
+    }
+    return true;
+  }
+
+  // a failed write keeps its error, a refused block reports the writer
+  bool Stopped(bool writeOk)
+  {
+    if (writeOk)
+      lastError = "writer stopped";
+    return false;
+  }
+
+  // check if the key at index is an integer in [1, n]
+  static bool ArrayKey(lua_State *L, int index, size_t n)
+  {
+    if (lua_type(L, index) != LUA_TNUMBER)
+      return false;
+    lua_Number k = lua_tonumber(L, index);
+    return k >= 1 && k <= static_cast<lua_Number>(n) && static_cast<lua_Number>(static_cast<size_t>(k)) == k;
+  }
+
+  bool Fail(lua_State *L, int top, const std::string &message)
+  {
+    lua_settop(L, top);
+    lastError = message;
+    return false;
+  }
+
+  bool Varint(uint64_t &v)
+  {
+    v = 0;
+    for (int shift = 0; shift < 64 && input.first != input.second; shift += 7)
+    {
+      uint8_t b = static_cast<uint8_t>(*input.first++);
+      v |= static_cast<uint64_t>(b & 0x7f) << shift;
+      if (!(b & 0x80))
+        return true;
+    }
+    return false;
+  }
+
+  size_t Remaining() const { return static_cast<size_t>(input.second - input.first); }
+
+  // reads one value and pushes it, tables are the table registry at stack index `tables`
+  bool Read(lua_State *L, int tables, int depth)
+  {
+    if (input.first == input.second)
+      return false;
+    uint8_t tag = static_cast<uint8_t>(*input.first++);
+    uint64_t v;
+    switch (tag)
+    {
+    case TagNil:
+      lua_pushnil(L);
+      return true;
+    case TagFalse:
+    case TagTrue:
+      lua_pushboolean(L, tag == TagTrue);
+      return true;
+    case TagInteger:
+      if (!Varint(v))
+        return false;
+      lua_pushnumber(L, static_cast<lua_Number>(static_cast<int64_t>((v >> 1) ^ (~(v & 1) + 1))));
+      return true;
+    case TagDouble:
+    {
+      if (Remaining() < 8)
+        return false;
+      uint64_t bits = 0;
+      for (int i = 0; i < 8; i++)
+        bits |= static_cast<uint64_t>(static_cast<uint8_t>(input.first[i])) << (8 * i);
+      input.first += 8;
+      double d;
+      std::memcpy(&d, &bits, sizeof(d));
+      lua_pushnumber(L, static_cast<lua_Number>(d));
+      return true;
+    }
+    case TagString:
+      if (!Varint(v) || v > Remaining())
+        return false;
+      lua_pushlstring(L, input.first, static_cast<size_t>(v));
+      if (v >= MinSharedString)
+        loadedStrings.emplace_back(input.first, static_cast<size_t>(v));
+      input.first += v;
+      return true;
+    case TagStringRef:
+      if (!Varint(v) || v >= loadedStrings.size())
+        return false;
+      lua_pushlstring(L, loadedStrings[v].first, loadedStrings[v].second);
+      return true;
+    case TagTableRef:
+      if (!Varint(v) || v >= loadedTables)
+        return false;
+      lua_rawgeti(L, tables, static_cast<int>(v + 1));
+      return true;
+    case TagTable:
+      return ReadTable(L, tables, depth);
+    default:
+      return false;
+    }
+  }
+
+  bool ReadTable(lua_State *L, int tables, int depth)
+  {
+    uint64_t narr, nhash;
+    // every entry takes at least a byte, larger counts are malformed
+    if (!Varint(narr) || !Varint(nhash) || narr > Remaining() || nhash > Remaining() / 2)
+      return false;
+    if (depth >= options.maxDepth || !lua_checkstack(L, 4))
+    {
+      lastError = "tables nested too deep";
+      return false;
+    }
+    lua_createtable(L, static_cast<int>(narr), static_cast<int>(nhash));
+    int table = lua_gettop(L);
+    lua_pushvalue(L, table);
+    lua_rawseti(L, tables, static_cast<int>(++loadedTables));
+    for (uint64_t i = 1; i <= narr; i++)
+    {
+      if (!Read(L, tables, depth + 1))
+        return false;
+      lua_rawseti(L, table, static_cast<int>(i));
+    }
+    for (uint64_t i = 0; i < nhash; i++)
+    {
+      if (!Read(L, tables, depth + 1))
+        return false;
+      if (lua_isnil(L, -1) || (lua_type(L, -1) == LUA_TNUMBER && std::isnan(lua_tonumber(L, -1))))
+        return false;
+      if (!Read(L, tables, depth + 1))
+        return false;
+      lua_rawset(L, table);
+    }
+    return true;
+  }
+
+  // the serializer is destroyed before lua_error, which does not unwind C++ frames
+  static int Encode(lua_State *L)
+  {
+    luaL_checkany(L, 1);
+    lua_settop(L, 1);
+    bool ok;
+    {
+      LuaSerializer serializer;
+      std::string out;
+      ok = serializer.save(L, 1, out);
+      if (ok)
+        lua_pushlstring(L, out.data(), out.size());
+      else
+        lua_pushfstring(L, "encode: %s", serializer.error().c_str());
+    }
+    return ok ? 1 : lua_error(L);
+  }
+
+  static int Decode(lua_State *L)
+  {
+    size_t len;
+    const char *data = luaL_checklstring(L, 1, &len);
+    LuaSerializer serializer;
+    if (serializer.load(L, data, len))
+      return 1;
+    lua_pushnil(L);
+    lua_pushstring(L, serializer.error().c_str());
+    return 2;
+  }
+
+  Options options;
+  std::string lastError;
+  PointerIds savedStrings;
+  PointerIds savedTables;
+  std::pair<const char *, const char *> input;
+  std::vector<std::pair<const char *, size_t>> loadedStrings;
+  uint64_t loadedTables = 0;
+};
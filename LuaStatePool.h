@@ -0,0 +1,235 @@
+// Copyright (C) 2023 Theros < MisModding | SvalTek >
+//
+// This file is part of LuaBinder.
+//
+// LuaBinder is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// LuaBinder is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LuaBinder.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+#include "LuaScript.h"
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// ─── LuaStatePool ────────────────────────────────────────────────────────────
+
+// class LuaStatePool
+// A fixed set of LuaScript states for hosts running scripts from many
+// threads. A lua_State can only be used by one thread at a time, so each
+// state is checked out for exclusive use and checked back in when the
+// Lease goes out of scope.
+//
+//   LuaStatePool pool(32, [](LuaScript &s) {
+//     LuaFunction<int(int, int)>::Register<add>(s.State(), "add");
+//     s.runFile("bootstrap.lua");
+//   });
+//   auto script = pool.checkout();
+//   script->runString("print(add(1, 2))");
+//
+// Leases must not outlive the pool.
+class LuaStatePool
+{
+public:
+  // creates a state, the default uses LuaPoolAllocator
+  using Factory = std::function<std::unique_ptr<LuaScript>()>;
+  // runs once on every new state: register functions, run bootstrap scripts
+  using WarmupHook = std::function<void(LuaScript &)>;
+  // runs on every checkin, returning false replaces the state with a new one
+  using ResetHook = std::function<bool(LuaScript &)>;
+
+  struct Options
+  {
+    size_t size = std::thread::hardware_concurrency();
+    Factory factory;
+    WarmupHook warmup;
+    ResetHook reset;
+    // prefer handing a thread the state it used last, so per-state caches
+    // (interned LuaPath tables, compiled chunks) stay warm for that thread
+    bool threadAffinity = false;
+    // binding call metrics shared by every state, attached before warmup
+    std::shared_ptr<LuaMetrics> metrics;
+  };
+
+  class Lease
+  {
+  public:
+    Lease() = default;
+    Lease(Lease &&other) noexcept : pool(other.pool), slot(other.slot) { other.pool = nullptr; }
+    Lease &operator=(Lease &&other) noexcept
+    {
+      if (this != &other)
+      {
+        release();
+        pool = other.pool;
+        slot = other.slot;
+        other.pool = nullptr;
+      }
+      return *this;
+    }
+    Lease(const Lease &) = delete;
+    Lease &operator=(const Lease &) = delete;
+    ~Lease() { release(); }
+
+    explicit operator bool() const { return pool != nullptr; }
+    LuaScript *operator->() const { return pool->slots[slot].script.get(); }
+    LuaScript &operator*() const { return *pool->slots[slot].script; }
+    LuaScript *get() const { return pool ? pool->slots[slot].script.get() : nullptr; }
+    lua_State *State() const { return get()->State(); }
+
+    /** Return the state to the pool early */
+    void release()
+    {
+      if (pool)
+        pool->checkin(slot);
+      pool = nullptr;
+    }
+
+  private:
+    friend class LuaStatePool;
+    Lease(LuaStatePool *pool, size_t slot) : pool(pool), slot(slot) {}
+
+    LuaStatePool *pool = nullptr;
+    size_t slot = 0;
+  };
+
+  explicit LuaStatePool(Options options) : options(std::move(options))
+  {
+    if (this->options.size == 0)
+      this->options.size = 1;
+    if (!this->options.factory)
+      this->options.factory = []() { return std::make_unique<LuaScript>(std::make_unique<LuaPoolAllocator>()); };
+    slots.resize(this->options.size);
+    for (size_t i = 0; i < slots.size(); i++)
+    {
+      slots[i].script = create();
+      freeSlots.push_back(i);
+    }
+  }
+
+  LuaStatePool(size_t size, WarmupHook warmup = nullptr, ResetHook reset = nullptr)
+      : LuaStatePool(Options{size, nullptr, std::move(warmup), std::move(reset), false, nullptr})
+  {
+  }
+
+  LuaStatePool(const LuaStatePool &) = delete;
+  LuaStatePool &operator=(const LuaStatePool &) = delete;
+
+  /** Check out a state, waiting until one is free
+   * @return Lease holding the state
+   */
+  Lease checkout()
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    available.wait(lock, [this]() { return !freeSlots.empty(); });
+    return Lease(this, take());
+  }
+
+  /** Check out a state, waiting at most timeout
+   * @return Lease holding the state, or an empty Lease on timeout
+   */
+  template <typename Rep, typename Period>
+  Lease checkout(const std::chrono::duration<Rep, Period> &timeout)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!available.wait_for(lock, timeout, [this]() { return !freeSlots.empty(); }))
+      return Lease();
+    return Lease(this, take());
+  }
+
+  /** Check out a state if one is free
+   * @return Lease holding the state, or an empty Lease
+   */
+  Lease tryCheckout()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (freeSlots.empty())
+      return Lease();
+    return Lease(this, take());
+  }
+
+  size_t size() const { return slots.size(); }
+
+  /** Get the binding metrics of all states, nullptr unless set in Options */
+  const std::shared_ptr<LuaMetrics> &metrics() const { return options.metrics; }
+
+  /** Get the number of states not checked out */
+  size_t idle() const
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return freeSlots.size();
+  }
+
+private:
+  struct Slot
+  {
+    std::unique_ptr<LuaScript> script;
+    std::thread::id owner;
+  };
+
+  std::unique_ptr<LuaScript> create()
+  {
+    std::unique_ptr<LuaScript> script = options.factory();
+    if (options.metrics)
+      script->setMetrics(options.metrics);
+    if (options.warmup)
+      options.warmup(*script);
+    return script;
+  }
+
+  // called with the mutex held and at least one free slot
+  size_t take()
+  {
+    size_t pick = freeSlots.size() - 1;
+    if (options.threadAffinity)
+    {
+      std::thread::id self = std::this_thread::get_id();
+      for (size_t i = 0; i < freeSlots.size(); i++)
+      {
+        if (slots[freeSlots[i]].owner == self)
+        {
+          pick = i;
+          break;
+        }
+      }
+    }
+    size_t slot = freeSlots[pick];
+    freeSlots[pick] = freeSlots.back();
+    freeSlots.pop_back();
+    slots[slot].owner = std::this_thread::get_id();
+    return slot;
+  }
+
+  void checkin(size_t slot)
+  {
+    // the slot is still exclusively ours, reset it outside the lock
+    LuaScript &script = *slots[slot].script;
+    if (script.State())
+      lua_settop(script.State(), 0);
+    if (options.reset && !options.reset(script))
+      slots[slot].script = create();
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      freeSlots.push_back(slot);
+    }
+    available.notify_one();
+  }
+
+  Options options;
+  std::vector<Slot> slots;
+  std::vector<size_t> freeSlots;
+  mutable std::mutex mutex;
+  std::condition_variable available;
+};